@@ -0,0 +1,74 @@
+#include "events/event_loop.h"
+#include "utils.h"
+#include "waymo/actions.h"
+#include <poll.h>
+#include <stdio.h>
+#include <time.h>
+
+#define CALLS 200000
+
+// WAIT_COMPLETE as it was before completion fds were reused per thread
+#define WAIT_COMPLETE_EVENTFD(cmd_func, ...)                                   \
+  do {                                                                         \
+    int efd = eventfd(0, EFD_CLOEXEC);                                         \
+    if (efd != -1) {                                                           \
+      cmd_func(__VA_ARGS__, efd);                                              \
+      uint64_t res;                                                            \
+      while (read(efd, &res, sizeof(res)) == -1 && errno == EINTR)             \
+        ;                                                                      \
+      close(efd);                                                              \
+    }                                                                          \
+  } while (0)
+
+static WAYMO_ATOMIC_BOOL stop;
+
+// Stands in for the event loop thread: completes each move without Wayland
+static void *fake_loop(void *arg) {
+  command_queue *q = arg;
+  struct pollfd pfd = {.fd = q->fd, .events = POLLIN};
+  while (!atomic_load(&stop)) {
+    if (poll(&pfd, 1, 10) <= 0)
+      continue;
+    ack_queue(q);
+    command *cmd;
+    while ((cmd = remove_queue(q))) {
+      signal_done(cmd->done.fd);
+      free_command(cmd);
+    }
+  }
+  return NULL;
+}
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+  waymo_event_loop loop = {0};
+  loop.queue = create_queue(50);
+  pthread_t t;
+  pthread_create(&t, NULL, fake_loop, loop.queue);
+
+  double start = now_s();
+  for (unsigned int i = 0; i < CALLS; i++)
+    WAIT_COMPLETE_EVENTFD(_send_command, &loop,
+                          _create_mouse_move_cmd(NULL, i, i, false));
+  double per_call = now_s() - start;
+
+  start = now_s();
+  for (unsigned int i = 0; i < CALLS; i++)
+    WAIT_COMPLETE(_send_command, &loop,
+                  _create_mouse_move_cmd(NULL, i, i, false));
+  double reused = now_s() - start;
+
+  printf("%-24s %14s\n", "completion", "move_mouse/s");
+  printf("%-24s %14.0f\n", "eventfd per call", CALLS / per_call);
+  printf("%-24s %14.0f\n", "per-thread eventfd", CALLS / reused);
+
+  atomic_store(&stop, true);
+  pthread_join(t, NULL);
+  destroy_queue(loop.queue);
+  return 0;
+}
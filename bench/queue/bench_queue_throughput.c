@@ -0,0 +1,143 @@
+#include "events/queue.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_CAPACITY 50 // Default eloop_params::max_commands
+#define PUSHES_PER_RUN 400000
+#define MAX_PRODUCERS 16
+
+// The queue as it was before the lock-free ring, kept as the baseline
+typedef struct {
+  command **commands;
+  unsigned int num_commands;
+  unsigned int front;
+  unsigned int back;
+  unsigned int max_capacity;
+  pthread_mutex_t mutex;
+  int fd;
+} mutex_queue;
+
+static bool mutex_add(mutex_queue *q, command *cmd) {
+  pthread_mutex_lock(&q->mutex);
+  if (q->num_commands >= q->max_capacity) {
+    pthread_mutex_unlock(&q->mutex);
+    return false;
+  }
+  q->commands[q->back] = cmd;
+  uint64_t u = 1;
+  if (write(q->fd, &u, sizeof(uint64_t)) == -1) {
+    pthread_mutex_unlock(&q->mutex);
+    return false;
+  }
+  q->back = (q->back + 1) % q->max_capacity;
+  q->num_commands++;
+  pthread_mutex_unlock(&q->mutex);
+  return true;
+}
+
+static command *mutex_remove(mutex_queue *q) {
+  pthread_mutex_lock(&q->mutex);
+  if (q->num_commands == 0) {
+    pthread_mutex_unlock(&q->mutex);
+    return NULL;
+  }
+  command *cmd = q->commands[q->front];
+  q->front = (q->front + 1) % q->max_capacity;
+  q->num_commands--;
+  pthread_mutex_unlock(&q->mutex);
+  return cmd;
+}
+
+typedef struct {
+  bool lock_free;
+  void *q;
+  unsigned int pushes;
+  command *cmd;
+} bench_arg;
+
+static void *producer(void *arg) {
+  bench_arg *a = arg;
+  for (unsigned int i = 0; i < a->pushes; i++) {
+    if (a->lock_free) {
+      while (!add_queue(a->q, a->cmd))
+        sched_yield();
+    } else {
+      while (!mutex_add(a->q, a->cmd))
+        sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static void *consumer(void *arg) {
+  bench_arg *a = arg;
+  unsigned int got = 0;
+  while (got < a->pushes) {
+    command *c = a->lock_free ? remove_queue(a->q) : mutex_remove(a->q);
+    if (c)
+      got++;
+    else
+      sched_yield();
+  }
+  return NULL;
+}
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double run(bool lock_free, unsigned int producers) {
+  command dummy;
+  void *q;
+  mutex_queue mq;
+  if (lock_free) {
+    q = create_queue(BENCH_CAPACITY);
+  } else {
+    mq.commands = calloc(BENCH_CAPACITY, sizeof(command *));
+    mq.num_commands = mq.front = mq.back = 0;
+    mq.max_capacity = BENCH_CAPACITY;
+    pthread_mutex_init(&mq.mutex, NULL);
+    mq.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    q = &mq;
+  }
+
+  unsigned int per = PUSHES_PER_RUN / producers;
+  bench_arg pargs = {lock_free, q, per, &dummy};
+  bench_arg cargs = {lock_free, q, per * producers, &dummy};
+  pthread_t pt[MAX_PRODUCERS], ct;
+
+  double start = now_s();
+  pthread_create(&ct, NULL, consumer, &cargs);
+  for (unsigned int i = 0; i < producers; i++)
+    pthread_create(&pt[i], NULL, producer, &pargs);
+  for (unsigned int i = 0; i < producers; i++)
+    pthread_join(pt[i], NULL);
+  pthread_join(ct, NULL);
+  double elapsed = now_s() - start;
+
+  if (lock_free) {
+    destroy_queue(q);
+  } else {
+    close(mq.fd);
+    pthread_mutex_destroy(&mq.mutex);
+    free(mq.commands);
+  }
+  return (double)(per * producers) / elapsed;
+}
+
+int main(void) {
+  printf("%-10s %18s %18s\n", "producers", "mutex (ops/s)", "lock-free (ops/s)");
+  for (unsigned int p = 1; p <= MAX_PRODUCERS; p *= 2) {
+    double m = run(false, p);
+    double l = run(true, p);
+    printf("%-10u %18.0f %18.0f\n", p, m, l);
+  }
+  return 0;
+}
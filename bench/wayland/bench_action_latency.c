@@ -0,0 +1,49 @@
+#include "compositor.h"
+#include <stdio.h>
+#include <time.h>
+
+#define ACTIONS 5000
+#define KEY_A 30
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// One key press and release the way the event loop sends it. The old loop
+// ended each iteration with a round trip, now completion only waits for the
+// requests to be flushed
+static double run(waymoctx *ctx, bool roundtrip) {
+  double start = now_s();
+  for (unsigned int i = 0; i < ACTIONS; i++) {
+    zwp_virtual_keyboard_v1_key(ctx->kbd, i, KEY_A,
+                                WL_KEYBOARD_KEY_STATE_PRESSED);
+    zwp_virtual_keyboard_v1_key(ctx->kbd, i, KEY_A,
+                                WL_KEYBOARD_KEY_STATE_RELEASED);
+    waymoctx_flush(ctx);
+    if (roundtrip)
+      wl_display_roundtrip(ctx->display);
+  }
+  return (now_s() - start) / ACTIONS * 1e6;
+}
+
+int main(void) {
+  static const unsigned int delays_us[] = {0, 100, 500};
+
+  printf("%-18s %16s %16s\n", "compositor delay", "roundtrip (us)",
+         "flush (us)");
+  for (size_t d = 0; d < sizeof(delays_us) / sizeof(delays_us[0]); d++) {
+    struct compositor comp = {.delay_us = delays_us[d]};
+    waymoctx ctx = {0};
+    if (!compositor_start(&comp, &ctx))
+      return 1;
+
+    double with_roundtrip = run(&ctx, true);
+    double flushed = run(&ctx, false);
+    printf("%-18u %16.2f %16.2f\n", delays_us[d], with_roundtrip, flushed);
+
+    compositor_stop(&comp, &ctx);
+  }
+  return 0;
+}
@@ -0,0 +1,92 @@
+#include "wayland/keymap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TOTAL_ENTRIES 200000 // Spread over the repetitions of each size
+
+// The keymap upload as it was before memfds, kept as the baseline
+static int stdio_keymap(const struct keymap_entry *keymap, size_t len,
+                        uint32_t *size) {
+  char filename[] = "/tmp/waymo-XXXXXX";
+  int fd = mkstemp(filename);
+  if (fd < 0)
+    return -1;
+  unlink(filename);
+  FILE *f = fdopen(fd, "w");
+
+  fprintf(f, "xkb_keymap {\n");
+  fprintf(f, "xkb_keycodes \"(unnamed)\" {\n  minimum = 8;\n  maximum = %zu;\n",
+          len + 8);
+  for (size_t i = 0; i < len; i++)
+    fprintf(f, "  <K%zu> = %zu;\n", i, i + 8);
+  fprintf(f, "};\n");
+  fprintf(f, "xkb_types \"(unnamed)\" { include \"complete\" };\n");
+  fprintf(f, "xkb_compatibility \"(unnamed)\" { include \"complete\" };\n");
+  fprintf(f, "xkb_symbols \"(unnamed)\" {\n");
+  for (size_t i = 0; i < len; i++) {
+    char name[64];
+    xkb_keysym_get_name(keymap[i].xkb, name, sizeof(name));
+    if (strcmp(name, "NoSymbol") == 0)
+      fprintf(f, "  key <K%zu> {[ U%04X ]};\n", i,
+              (unsigned int)keymap[i].wchr);
+    else
+      fprintf(f, "  key <K%zu> {[ %s ]};\n", i, name);
+  }
+  fprintf(f, "};\n};\n");
+
+  *size = (uint32_t)ftell(f);
+  rewind(f);
+  int out = dup(fd);
+  fclose(f);
+  return out;
+}
+
+// Just the dynamic keys, as before layouts were compiled
+static int memfd_keymap(const struct keymap_entry *keymap, size_t len,
+                        uint32_t *size) {
+  return keymap_memfd(NULL, keymap, len, size);
+}
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double time_us(int (*gen)(const struct keymap_entry *, size_t,
+                                 uint32_t *),
+                      const struct keymap_entry *keymap, size_t len) {
+  size_t reps = TOTAL_ENTRIES / len;
+  double start = now_s();
+  for (size_t r = 0; r < reps; r++) {
+    uint32_t size;
+    int fd = gen(keymap, len, &size);
+    if (fd < 0)
+      return -1;
+    close(fd);
+  }
+  return (now_s() - start) / reps * 1e6;
+}
+
+int main(void) {
+  static const size_t sizes[] = {100, 1000, 10000};
+
+  printf("%-10s %18s %18s\n", "entries", "stdio tmpfile (us)", "memfd (us)");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    size_t len = sizes[s];
+    struct keymap_entry *keymap = malloc(len * sizeof(struct keymap_entry));
+    // ASCII first like the default keymap, then whatever text brought in
+    for (size_t i = 0; i < len; i++) {
+      keymap[i].wchr = (wchar_t)(i < 94 ? 33 + i : 0xa0 + i);
+      keymap[i].xkb = xkb_utf32_to_keysym((uint32_t)keymap[i].wchr);
+    }
+
+    printf("%-10zu %18.2f %18.2f\n", len, time_us(stdio_keymap, keymap, len),
+           time_us(memfd_keymap, keymap, len));
+    free(keymap);
+  }
+  return 0;
+}
@@ -0,0 +1,75 @@
+#include "compositor.h"
+#include "events/pendings.h"
+#include "waymo/actions_internal.h"
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+#define CHARS 20000
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Types text with a zero interval the way the event loop does, one timer
+// expiry and one flush per tick, and returns characters per second
+static double run(waymoctx *ctx, const char *text, unsigned int burst) {
+  waymo_event_loop loop = {0};
+  pthread_mutex_init(&loop.pending_mutex, NULL);
+  loop.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  loop.type_burst = burst;
+  int done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  uint32_t interval = 0;
+  command *cmd = _create_keyboard_type_cmd(NULL, text, &interval);
+  double start = now_s();
+  ekbd_type(&loop, ctx, &cmd->param, (completion){.fd = done_fd});
+
+  uint64_t u;
+  while (read(done_fd, &u, sizeof(u)) != sizeof(u)) {
+    struct pollfd pfd = {.fd = loop.timer_fd, .events = POLLIN};
+    poll(&pfd, 1, -1);
+    if (read(loop.timer_fd, &u, sizeof(u)) != sizeof(u))
+      continue;
+    handle_timer_expiry(&loop, ctx);
+    flush_tick(&loop, ctx);
+  }
+  double elapsed = now_s() - start;
+
+  _discard_command(cmd);
+  clear_pending_actions(&loop);
+  free(loop.finished);
+  close(done_fd);
+  close(loop.timer_fd);
+  pthread_mutex_destroy(&loop.pending_mutex);
+  return CHARS / elapsed;
+}
+
+int main(void) {
+  // Burst 1 is how type used to run, one key per timer expiry
+  static const unsigned int bursts[] = {1, 16, 32, 64, 256};
+
+  char *text = malloc(CHARS + 1);
+  for (size_t i = 0; i < CHARS; i++)
+    text[i] = (char)('a' + i % 26);
+  text[CHARS] = '\0';
+
+  struct compositor comp = {0};
+  waymoctx ctx = {0};
+  if (!text || !compositor_start(&comp, &ctx))
+    return 1;
+
+  printf("%-8s %16s\n", "burst", "chars/s");
+  for (size_t b = 0; b < sizeof(bursts) / sizeof(bursts[0]); b++)
+    printf("%-8u %16.0f\n", bursts[b], run(&ctx, text, bursts[b]));
+
+  waymoctx_destroy_kbd(&ctx);
+  compositor_stop(&comp, &ctx);
+  free(text);
+  return 0;
+}
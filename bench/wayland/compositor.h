@@ -0,0 +1,100 @@
+#ifndef BENCH_COMPOSITOR_H
+#define BENCH_COMPOSITOR_H
+
+#include "wayland/waycon.h"
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+// Wire format of a message header, see the Wayland protocol spec
+#define MSG_SIZE(word) ((word) >> 16)
+#define MSG_OPCODE(word) ((word) & 0xffff)
+#define WL_DISPLAY_ID 1
+
+struct compositor {
+  int fd;
+  unsigned int delay_us; // Time spent handling each sync before replying
+  pthread_t thread;
+};
+
+static void reply(int fd, uint32_t id, uint16_t opcode, uint32_t arg) {
+  uint32_t msg[3] = {id, (12u << 16) | opcode, arg};
+  ssize_t off = 0;
+  while (off < (ssize_t)sizeof(msg)) {
+    ssize_t n = write(fd, (char *)msg + off, sizeof(msg) - off);
+    if (n <= 0)
+      return;
+    off += n;
+  }
+}
+
+// Stands in for the compositor: reads every request and only answers
+// wl_display.sync, which is all a round trip waits on. Objects the client
+// creates are never checked, the requests sent to them are just dropped
+static void *compositor_thread(void *arg) {
+  struct compositor *c = arg;
+  uint32_t buf[1024];
+  size_t len = 0;
+  uint32_t serial = 0;
+
+  while (true) {
+    ssize_t n = read(c->fd, (char *)buf + len, sizeof(buf) - len);
+    if (n <= 0)
+      break;
+    len += n;
+
+    size_t off = 0;
+    while (len - off >= 8) {
+      uint32_t *msg = (uint32_t *)((char *)buf + off);
+      size_t size = MSG_SIZE(msg[1]);
+      if (size < 8 || len - off < size)
+        break;
+      if (msg[0] == WL_DISPLAY_ID && MSG_OPCODE(msg[1]) == 0) {
+        if (c->delay_us)
+          usleep(c->delay_us);
+        reply(c->fd, msg[2], 0, serial++); // wl_callback.done
+        reply(c->fd, WL_DISPLAY_ID, 1, msg[2]); // wl_display.delete_id
+      }
+      off += size;
+    }
+    memmove(buf, (char *)buf + off, len - off);
+    len -= off;
+  }
+  return NULL;
+}
+
+// Connects ctx to a fresh stand-in with a virtual keyboard ready to use
+static bool compositor_start(struct compositor *c, waymoctx *ctx) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+    return false;
+  c->fd = fds[1];
+  pthread_create(&c->thread, NULL, compositor_thread, c);
+
+  ctx->display = wl_display_connect_to_fd(fds[0]);
+  if (!ctx->display)
+    return false;
+  ctx->registry = wl_display_get_registry(ctx->display);
+  ctx->seat = wl_registry_bind(ctx->registry, 1, &wl_seat_interface, 1);
+  ctx->kman = wl_registry_bind(ctx->registry, 2,
+                               &zwp_virtual_keyboard_manager_v1_interface, 1);
+  ctx->kbd = zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
+      ctx->kman, ctx->seat);
+  return true;
+}
+
+static void compositor_stop(struct compositor *c, waymoctx *ctx) {
+  if (ctx->kbd)
+    zwp_virtual_keyboard_v1_destroy(ctx->kbd);
+  zwp_virtual_keyboard_manager_v1_destroy(ctx->kman);
+  wl_seat_destroy(ctx->seat);
+  wl_registry_destroy(ctx->registry);
+  // Closes the client end, which ends the compositor thread
+  wl_display_disconnect(ctx->display);
+  pthread_join(c->thread, NULL);
+  close(c->fd);
+}
+
+#endif
@@ -34,6 +34,63 @@ bool parse_mouse_btn(const char *str, MBTNS *out_btn) {
   return false;
 }
 
+// Takes exactly one UTF-8 encoded character
+bool parse_char(const char *str, uint32_t *out_cp) {
+  const unsigned char *s = (const unsigned char *)str;
+  if (!s || !s[0])
+    return false;
+
+  size_t n;
+  uint32_t cp, min;
+  if (s[0] < 0x80)
+    n = 1, cp = s[0], min = 0;
+  else if (s[0] >= 0xc2 && s[0] <= 0xdf)
+    n = 2, cp = s[0] & 0x1f, min = 0x80;
+  else if (s[0] >= 0xe0 && s[0] <= 0xef)
+    n = 3, cp = s[0] & 0x0f, min = 0x800;
+  else if (s[0] >= 0xf0 && s[0] <= 0xf4)
+    n = 4, cp = s[0] & 0x07, min = 0x10000;
+  else
+    return false;
+
+  for (size_t i = 1; i < n; i++) {
+    if ((s[i] & 0xc0) != 0x80)
+      return false;
+    cp = (cp << 6) | (s[i] & 0x3f);
+  }
+  if (s[n] || cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+    return false;
+  *out_cp = cp;
+  return true;
+}
+
+// Takes modifiers joined by +, such as ctrl+shift
+bool parse_mods(const char *str, unsigned int *out_mods) {
+  if (!str)
+    return false;
+
+  unsigned int mods = 0;
+  while (*str) {
+    size_t len = strcspn(str, "+");
+    if (len == 5 && strncasecmp(str, "shift", len) == 0)
+      mods |= KMOD_SHIFT;
+    else if (len == 4 && strncasecmp(str, "ctrl", len) == 0)
+      mods |= KMOD_CTRL;
+    else if (len == 3 && strncasecmp(str, "alt", len) == 0)
+      mods |= KMOD_ALT;
+    else if (len == 5 && strncasecmp(str, "super", len) == 0)
+      mods |= KMOD_SUPER;
+    else
+      return false;
+    str += len;
+    if (*str == '+')
+      str++;
+  }
+
+  *out_mods = mods;
+  return true;
+}
+
 void print_usage(const char *prog) {
   fprintf(stderr, "Usage: %s [options] <action> [args]\n", prog);
   fprintf(
@@ -46,6 +103,7 @@ void print_usage(const char *prog) {
   fprintf(stderr, "  type <text> [interval_ms]\n");
   fprintf(stderr, "  press_key <char> <is_down> [interval_ms]\n");
   fprintf(stderr, "  hold_key <char> <hold_ms> [interval_ms]\n");
+  fprintf(stderr, "  shortcut <mods> <char>  (mods such as ctrl+shift)\n");
 }
 
 int main(int argc, char **argv) {
@@ -76,8 +134,11 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  const eloop_params params = {
-      .action_cooldown_ms = 0, .kbd_layout = layout, .max_commands = 1};
+  // Each run is a new process, so reuse the layout compiled by the last one
+  const eloop_params params = {.action_cooldown_ms = 0,
+                               .kbd_layout = layout,
+                               .max_commands = 1,
+                               .keymap_cache = true};
 
   waymo_event_loop *loop = create_event_loop(&params);
   if (!loop) {
@@ -195,6 +256,18 @@ int main(int argc, char **argv) {
 
     hold_key(loop, key, interval_ptr, hold_ms);
 
+  } else if (strcmp(action, "shortcut") == 0) {
+    unsigned int mods;
+    uint32_t cp;
+    if (args_left < 2 || !parse_mods(args[0], &mods) ||
+        !parse_char(args[1], &cp)) {
+      fprintf(stderr, "Usage: shortcut <mods> <char>\n");
+      ret = 1;
+      goto cleanup;
+    }
+
+    send_shortcut(loop, mods, cp);
+
   } else {
     fprintf(stderr, "Unknown action: %s\n", action);
     print_usage(argv[0]);
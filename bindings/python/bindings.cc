@@ -25,7 +25,13 @@ NB_MODULE(waymo_python, m) {
       .def(nb::init<>())
       .def_rw("max_commands", &eloop_params::max_commands)
       .def_rw("kbd_layout", &eloop_params::kbd_layout)
-      .def_rw("action_cooldown_ms", &eloop_params::action_cooldown_ms);
+      .def_rw("action_cooldown_ms", &eloop_params::action_cooldown_ms)
+      .def_rw("ring_entries", &eloop_params::ring_entries)
+      .def_rw("command_pool", &eloop_params::command_pool)
+      .def_rw("pending_pool", &eloop_params::pending_pool)
+      .def_rw("keymap_capacity", &eloop_params::keymap_capacity)
+      .def_rw("type_burst", &eloop_params::type_burst)
+      .def_rw("keymap_cache", &eloop_params::keymap_cache);
 
   nb::class_<waymo_event_loop> el(m, "WaymoEventLoop");
 
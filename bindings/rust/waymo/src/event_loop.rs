@@ -1,4 +1,4 @@
-use libc::{c_char, close, eventfd, read, EFD_CLOEXEC, EINTR};
+use libc::{read, EINTR};
 use std::ffi::CString;
 use std::ptr;
 use waymo_sys as wsys;
@@ -34,7 +34,8 @@ impl WaymoEventLoop {
         F: FnOnce(i32),
     {
         unsafe {
-            let efd = eventfd(0, EFD_CLOEXEC);
+            // Reuses the calling thread's eventfd owned by the C library
+            let efd = wsys::_thread_done_fd();
             if efd != -1 {
                 f(efd);
                 let mut res: u64 = 0;
@@ -43,28 +44,27 @@ impl WaymoEventLoop {
                         break;
                     }
                 }
-                close(efd);
             }
         }
     }
 
     pub fn move_mouse(&self, x: u32, y: u32, relative: bool) {
         self.wait_complete(|efd| unsafe {
-            let cmd = wsys::_create_mouse_move_cmd(x, y, relative);
+            let cmd = wsys::_create_mouse_move_cmd(self.inner, x, y, relative);
             wsys::_send_command(self.inner, cmd, efd);
         });
     }
 
     pub fn click_mouse(&self, btn: MouseButton, clicks: u32, hold_ms: u32) {
         self.wait_complete(|efd| unsafe {
-            let cmd = wsys::_create_mouse_click_cmd(btn.into(), clicks, hold_ms);
+            let cmd = wsys::_create_mouse_click_cmd(self.inner, btn.into(), clicks, hold_ms);
             wsys::_send_command(self.inner, cmd, efd);
         });
     }
 
     pub fn press_mouse(&self, btn: MouseButton, down: bool) {
         self.wait_complete(|efd| unsafe {
-            let cmd = wsys::_create_mouse_button_cmd(btn.into(), down);
+            let cmd = wsys::_create_mouse_button_cmd(self.inner, btn.into(), down);
             wsys::_send_command(self.inner, cmd, efd);
         });
     }
@@ -72,7 +72,7 @@ impl WaymoEventLoop {
     pub fn press_key(&self, key: char, interval_ms: Option<&mut u32>, down: bool) {
         unsafe {
             let interval_ptr = interval_ms.map_or(ptr::null_mut(), |v| v);
-            let cmd = wsys::_create_keyboard_key_cmd_b(key as c_char, interval_ptr, down);
+            let cmd = wsys::_create_keyboard_codepoint_cmd_b(self.inner, key as u32, interval_ptr, down);
             wsys::_send_command(self.inner, cmd, -1);
         }
     }
@@ -80,7 +80,7 @@ impl WaymoEventLoop {
     pub fn hold_key(&self, key: char, interval_ms: Option<&mut u32>, hold_ms: u32) {
         unsafe {
             let interval_ptr = interval_ms.map_or(ptr::null_mut(), |v| v);
-            let cmd = wsys::_create_keyboard_key_cmd_uintt(key as c_char, interval_ptr, hold_ms);
+            let cmd = wsys::_create_keyboard_codepoint_cmd_uintt(self.inner, key as u32, interval_ptr, hold_ms);
             wsys::_send_command(self.inner, cmd, -1);
         }
     }
@@ -89,7 +89,7 @@ impl WaymoEventLoop {
         if let Ok(c_str) = CString::new(text) {
             self.wait_complete(|efd| unsafe {
                 let interval_ptr = interval_ms.map_or(ptr::null_mut(), |v| v);
-                let cmd = wsys::_create_keyboard_type_cmd(c_str.as_ptr(), interval_ptr);
+                let cmd = wsys::_create_keyboard_type_cmd(self.inner, c_str.as_ptr(), interval_ptr);
                 wsys::_send_command(self.inner, cmd, efd);
             });
         }
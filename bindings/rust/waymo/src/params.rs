@@ -34,6 +34,12 @@ pub struct EloopParamsBuilder {
     max_commands: u32,
     kbd_layout: String,
     action_cooldown_ms: u32,
+    ring_entries: u32,
+    command_pool: u32,
+    pending_pool: u32,
+    keymap_capacity: u32,
+    type_burst: u32,
+    keymap_cache: bool,
 }
 
 impl EloopParamsBuilder {
@@ -42,6 +48,12 @@ impl EloopParamsBuilder {
             max_commands: 50,
             kbd_layout: String::from("us"),
             action_cooldown_ms: 0,
+            ring_entries: 0,
+            command_pool: 0,
+            pending_pool: 0,
+            keymap_capacity: 0,
+            type_burst: 0,
+            keymap_cache: false,
         }
     }
 
@@ -60,12 +72,48 @@ impl EloopParamsBuilder {
         self
     }
 
+    pub fn ring_entries(mut self, entries: u32) -> Self {
+        self.ring_entries = entries;
+        self
+    }
+
+    pub fn command_pool(mut self, count: u32) -> Self {
+        self.command_pool = count;
+        self
+    }
+
+    pub fn pending_pool(mut self, count: u32) -> Self {
+        self.pending_pool = count;
+        self
+    }
+
+    pub fn keymap_capacity(mut self, entries: u32) -> Self {
+        self.keymap_capacity = entries;
+        self
+    }
+
+    pub fn type_burst(mut self, keys: u32) -> Self {
+        self.type_burst = keys;
+        self
+    }
+
+    pub fn keymap_cache(mut self, enabled: bool) -> Self {
+        self.keymap_cache = enabled;
+        self
+    }
+
     pub fn build(self) -> EloopParams {
         let c_layout = CString::new(self.kbd_layout).unwrap();
         let inner = Box::into_raw(Box::new(wsys::eloop_params {
             max_commands: self.max_commands,
             kbd_layout: c_layout.into_raw(),
             action_cooldown_ms: self.action_cooldown_ms,
+            ring_entries: self.ring_entries,
+            command_pool: self.command_pool,
+            pending_pool: self.pending_pool,
+            keymap_capacity: self.keymap_capacity,
+            type_burst: self.type_burst,
+            keymap_cache: self.keymap_cache,
         }));
 
         EloopParams { inner }
@@ -24,7 +24,8 @@ extern "C" {
  */
 static inline void move_mouse(waymo_event_loop *loop, unsigned int x,
                               unsigned int y, bool relative) {
-  WAIT_COMPLETE(_send_command, loop, _create_mouse_move_cmd(x, y, relative));
+  WAIT_COMPLETE(_send_command, loop,
+                _create_mouse_move_cmd(loop, x, y, relative));
 }
 
 /**
@@ -37,7 +38,7 @@ static inline void move_mouse(waymo_event_loop *loop, unsigned int x,
 static inline void click_mouse(waymo_event_loop *loop, MBTNS btn,
                                unsigned int clicks, uint32_t hold_ms) {
   WAIT_COMPLETE(_send_command, loop,
-                _create_mouse_click_cmd(btn, clicks, hold_ms));
+                _create_mouse_click_cmd(loop, btn, clicks, hold_ms));
 }
 
 /**
@@ -47,34 +48,37 @@ static inline void click_mouse(waymo_event_loop *loop, MBTNS btn,
  * @param[in] down  If the button should be down or up
  */
 static inline void press_mouse(waymo_event_loop *loop, MBTNS btn, bool down) {
-  WAIT_COMPLETE(_send_command, loop, _create_mouse_button_cmd(btn, down));
+  WAIT_COMPLETE(_send_command, loop, _create_mouse_button_cmd(loop, btn, down));
 }
 
 /**
  * @brief Press a key down or up
- * Pressing keys with a dynamic keymap on Wayland does not work well due to
- * refreshing of that keymap This means that I must constantly press that key to
- * emulate holding
+ * A key put down is pressed once and stays down until the same key is put up,
+ * the focused client repeats it like any held key
  * @param[in] loop	    Pointer to the event loop
  * @param[in] key  	    The key to press
- * @param[in] interval_ms  A pointer to a uint32_t to represent how long in
- * between each press (pass NULL for default)
+ * @param[in] interval_ms  A pointer to a uint32_t to have waymo press the key
+ * again every interval_ms while it is down (pass NULL to leave repeating to
+ * the client)
  * @param[in] down	    If the key to be pressed should be down or not
  */
 static inline void press_key(waymo_event_loop *loop, char key,
                              uint32_t *interval_ms, bool down) {
 #ifdef __cplusplus
-  _send_command(loop, _create_keyboard_key_cmd_b(key, interval_ms, down), -1);
+  _send_command(loop, _create_keyboard_key_cmd_b(loop, key, interval_ms, down),
+                -1);
 #else
-  _send_command(loop, _create_keyboard_key_cmd(key, interval_ms, down), -1);
+  _send_command(loop, _create_keyboard_key_cmd(loop, key, interval_ms, down),
+                -1);
 #endif
 }
 
 /**
  * @brief Holds a key down for some amount of time
- * Pressing keys with a dynamic keymap on Wayland does not work well due to
- * refreshing of the dynamic keymap This means that the keys must be held down
- * to emulate holding
+ * The key is not left down but tapped, pressed and released, once every
+ * interval until hold_ms has passed, the way a client repeats a held key. A
+ * zero interval, or one of at least hold_ms, taps it once. press_key leaves a
+ * key down
  * @param[in] loop	    Pointer to the event loop
  * @param[in] key	    The key to press
  * @param[in] interval_ms  A pointer to a uint32_t to represent how long should
@@ -84,24 +88,446 @@ static inline void press_key(waymo_event_loop *loop, char key,
 static inline void hold_key(waymo_event_loop *loop, char key,
                             uint32_t *interval_ms, uint32_t hold_ms) {
 #ifdef __cplusplus
-  _send_command(loop, _create_keyboard_key_cmd_uintt(key, interval_ms, hold_ms),
-                -1);
+  _send_command(
+      loop, _create_keyboard_key_cmd_uintt(loop, key, interval_ms, hold_ms),
+      -1);
 #else
-  _send_command(loop, _create_keyboard_key_cmd(key, interval_ms, hold_ms), -1);
+  _send_command(loop,
+                _create_keyboard_key_cmd(loop, key, interval_ms, hold_ms), -1);
 #endif
 }
 
+/**
+ * @brief Press a key down or up by its Unicode code point, see press_key
+ * @param[in] loop        Pointer to the event loop
+ * @param[in] codepoint   The code point of the key to press
+ * @param[in] interval_ms A pointer to the ms between presses while the key is
+ * down (pass NULL to leave repeating to the client)
+ * @param[in] down        If the key to be pressed should be down or not
+ */
+static inline void press_codepoint(waymo_event_loop *loop, uint32_t codepoint,
+                                   uint32_t *interval_ms, bool down) {
+  _send_command(
+      loop,
+      _create_keyboard_codepoint_cmd_b(loop, codepoint, interval_ms, down),
+      -1);
+}
+
+/**
+ * @brief Holds a key down by its Unicode code point, see hold_key
+ * @param[in] loop        Pointer to the event loop
+ * @param[in] codepoint   The code point of the key to press
+ * @param[in] interval_ms A pointer to a uint32_t to represent how long should
+ * be left in between each press (NULL for default)
+ * @param[in] hold_ms     How long the key should be held for in ms
+ */
+static inline void hold_codepoint(waymo_event_loop *loop, uint32_t codepoint,
+                                  uint32_t *interval_ms, uint32_t hold_ms) {
+  _send_command(loop,
+                _create_keyboard_codepoint_cmd_uintt(loop, codepoint,
+                                                     interval_ms, hold_ms),
+                -1);
+}
+
+/**
+ * @brief Presses and releases a key with modifiers held, such as Ctrl+C
+ * The modifiers, the key and the release of the modifiers are sent together
+ * @param[in] loop Pointer to the event loop
+ * @param[in] mods Modifiers from the KMODS enum combined with | (include
+ * btns.h)
+ * @param[in] key  The Unicode code point of the key
+ */
+static inline void send_shortcut(waymo_event_loop *loop, unsigned int mods,
+                                 uint32_t key) {
+  WAIT_COMPLETE(_send_command, loop,
+                _create_keyboard_shortcut_cmd(loop, mods, key));
+}
+
 /**
  * @brief Types a string
  * @param[in] loop	 Pointer to the event loop
  * @param[in] text 	 String to type out
  * @param[in] interval_ms A pointer to the ms between each key being clicked
- * (NULL for default)
+ * (NULL for default). Zero types as fast as the compositor accepts, in bursts
+ * of up to eloop_params::type_burst keys
  */
 static inline void type(waymo_event_loop *loop, const char *text,
                         uint32_t *interval_ms) {
   WAIT_COMPLETE(_send_command, loop,
-                _create_keyboard_type_cmd(text, interval_ms));
+                _create_keyboard_type_cmd(loop, text, interval_ms));
+}
+
+/**
+ * @brief Clicks a button on the mouse with a hold time in microseconds
+ * The event loop schedules in nanoseconds so holds below a millisecond are
+ * kept rather than rounded, see click_mouse
+ * @param[in] loop    Pointer to the event loop
+ * @param[in] btn     Button to click from MBTNS enum (include btns.h)
+ * @param[in] clicks  The number of times to click
+ * @param[in] hold_us The time in us to hold the button down per click
+ */
+static inline void click_mouse_us(waymo_event_loop *loop, MBTNS btn,
+                                  unsigned int clicks, uint32_t hold_us) {
+  WAIT_COMPLETE(_send_command, loop,
+                _create_mouse_click_cmd_us(loop, btn, clicks, hold_us));
+}
+
+/**
+ * @brief Press a key down or up with a repeat interval in microseconds
+ * @param[in] loop        Pointer to the event loop
+ * @param[in] key         The key to press
+ * @param[in] interval_us A pointer to the us between presses while the key is
+ * down (NULL to leave repeating to the client)
+ * @param[in] down        If the key to be pressed should be down or not
+ */
+static inline void press_key_us(waymo_event_loop *loop, char key,
+                                uint32_t *interval_us, bool down) {
+  _send_command(
+      loop, _create_keyboard_key_cmd_b_us(loop, key, interval_us, down), -1);
+}
+
+/**
+ * @brief Holds a key down with the interval and duration in microseconds
+ * @param[in] loop        Pointer to the event loop
+ * @param[in] key         The key to press
+ * @param[in] interval_us A pointer to the us between each press (NULL for
+ * default)
+ * @param[in] hold_us     How long the key should be held for in us
+ */
+static inline void hold_key_us(waymo_event_loop *loop, char key,
+                               uint32_t *interval_us, uint32_t hold_us) {
+  _send_command(
+      loop, _create_keyboard_key_cmd_uintt_us(loop, key, interval_us, hold_us),
+      -1);
+}
+
+/**
+ * @brief Types a string with the interval between keys in microseconds
+ * @param[in] loop        Pointer to the event loop
+ * @param[in] text        String to type out
+ * @param[in] interval_us A pointer to the us between each key being clicked
+ * (NULL for default)
+ */
+static inline void type_us(waymo_event_loop *loop, const char *text,
+                           uint32_t *interval_us) {
+  WAIT_COMPLETE(_send_command, loop,
+                _create_keyboard_type_cmd_us(loop, text, interval_us));
+}
+
+/**
+ * @brief Moves the mouse without waiting for it to happen
+ * The async variants return as soon as the action is queued. cb is then called
+ * on the event loop thread once the action has finished, so many actions can be
+ * in flight from one thread
+ * @param[in] loop      Pointer to the event loop
+ * @param[in] x         X coordinate on the screen
+ * @param[in] y         Y coordinate on the screen
+ * @param[in] relative  True if the coordinates should be relative to current
+ * coordinates
+ * @param[in] cb        Called when the action finishes (NULL for none)
+ * @param[in] user_data Passed to cb
+ * @return The ticket of the action or 0 if it could not be queued, in which
+ * case cb is never called
+ */
+static inline action_ticket move_mouse_async(waymo_event_loop *loop,
+                                             unsigned int x, unsigned int y,
+                                             bool relative, action_done_cb cb,
+                                             void *user_data) {
+  return _send_command_async(
+      loop, _create_mouse_move_cmd(loop, x, y, relative), cb, user_data);
+}
+
+/**
+ * @brief Clicks a button on the mouse without waiting, see move_mouse_async
+ * @param[in] loop      Pointer to the event loop
+ * @param[in] btn       Button to click from MBTNS enum (include btns.h)
+ * @param[in] clicks    The number of times to click
+ * @param[in] hold_ms   The time in ms to hold the button down per click
+ * @param[in] cb        Called after the last release (NULL for none)
+ * @param[in] user_data Passed to cb
+ * @return The ticket of the action or 0 if it could not be queued
+ */
+static inline action_ticket click_mouse_async(waymo_event_loop *loop,
+                                              MBTNS btn, unsigned int clicks,
+                                              uint32_t hold_ms,
+                                              action_done_cb cb,
+                                              void *user_data) {
+  return _send_command_async(
+      loop, _create_mouse_click_cmd(loop, btn, clicks, hold_ms), cb,
+      user_data);
+}
+
+/**
+ * @brief Changes a mouse button without waiting, see move_mouse_async
+ * @param[in] loop      Pointer to the event loop
+ * @param[in] btn       Button to click from the MBTNS enum (include btns.h)
+ * @param[in] down      If the button should be down or up
+ * @param[in] cb        Called when the action finishes (NULL for none)
+ * @param[in] user_data Passed to cb
+ * @return The ticket of the action or 0 if it could not be queued
+ */
+static inline action_ticket press_mouse_async(waymo_event_loop *loop,
+                                              MBTNS btn, bool down,
+                                              action_done_cb cb,
+                                              void *user_data) {
+  return _send_command_async(loop, _create_mouse_button_cmd(loop, btn, down),
+                             cb, user_data);
+}
+
+/**
+ * @brief Presses a key down or up, see press_key and move_mouse_async
+ * @param[in] loop        Pointer to the event loop
+ * @param[in] key         The key to press
+ * @param[in] interval_ms A pointer to the ms between presses while the key is
+ * down (pass NULL to leave repeating to the client)
+ * @param[in] down        If the key to be pressed should be down or not
+ * @param[in] cb          Called once the key state changed (NULL for none)
+ * @param[in] user_data   Passed to cb
+ * @return The ticket of the action or 0 if it could not be queued
+ */
+static inline action_ticket press_key_async(waymo_event_loop *loop, char key,
+                                            uint32_t *interval_ms, bool down,
+                                            action_done_cb cb,
+                                            void *user_data) {
+  return _send_command_async(
+      loop, _create_keyboard_key_cmd_b(loop, key, interval_ms, down), cb,
+      user_data);
+}
+
+/**
+ * @brief Holds a key down for some amount of time, see hold_key and
+ * move_mouse_async
+ * @param[in] loop        Pointer to the event loop
+ * @param[in] key         The key to press
+ * @param[in] interval_ms A pointer to a uint32_t to represent how long should
+ * be left in between each press (NULL for default)
+ * @param[in] hold_ms     How long the key should be held for in ms
+ * @param[in] cb          Called once the hold is over (NULL for none)
+ * @param[in] user_data   Passed to cb
+ * @return The ticket of the action or 0 if it could not be queued
+ */
+static inline action_ticket hold_key_async(waymo_event_loop *loop, char key,
+                                           uint32_t *interval_ms,
+                                           uint32_t hold_ms, action_done_cb cb,
+                                           void *user_data) {
+  return _send_command_async(
+      loop, _create_keyboard_key_cmd_uintt(loop, key, interval_ms, hold_ms), cb,
+      user_data);
+}
+
+/**
+ * @brief Sends a shortcut without waiting, see send_shortcut and
+ * move_mouse_async
+ * @param[in] loop      Pointer to the event loop
+ * @param[in] mods      Modifiers from the KMODS enum combined with |
+ * @param[in] key       The Unicode code point of the key
+ * @param[in] cb        Called once the modifiers are released (NULL for none)
+ * @param[in] user_data Passed to cb
+ * @return The ticket of the action or 0 if it could not be queued
+ */
+static inline action_ticket send_shortcut_async(waymo_event_loop *loop,
+                                                unsigned int mods, uint32_t key,
+                                                action_done_cb cb,
+                                                void *user_data) {
+  return _send_command_async(
+      loop, _create_keyboard_shortcut_cmd(loop, mods, key), cb, user_data);
+}
+
+/**
+ * @brief Types a string without waiting, see move_mouse_async
+ * @param[in] loop        Pointer to the event loop
+ * @param[in] text        String to type out, copied before this returns
+ * @param[in] interval_ms A pointer to the ms between each key being clicked
+ * (NULL for default)
+ * @param[in] cb          Called after the last character (NULL for none)
+ * @param[in] user_data   Passed to cb
+ * @return The ticket of the action or 0 if it could not be queued
+ */
+static inline action_ticket type_async(waymo_event_loop *loop,
+                                       const char *text, uint32_t *interval_ms,
+                                       action_done_cb cb, void *user_data) {
+  return _send_command_async(
+      loop, _create_keyboard_type_cmd(loop, text, interval_ms), cb, user_data);
+}
+
+/**
+ * @brief Stops an action queued by one of the async functions
+ * Anything it left pressed is released and its cb is called with
+ * RESULT_CANCELLED. The cancel is queued behind everything submitted before it
+ * so it cannot overtake the action, but it does not wait for the action
+ * cooldown and does not restart it. Keys the action already sent that are
+ * still waiting on a keymap upload go out regardless. Ring submissions have no
+ * ticket, only waymo_cancel_all stops them
+ * @param[in] loop   Pointer to the event loop
+ * @param[in] ticket The ticket returned for the action, for a batch that of the
+ * whole batch
+ */
+static inline void waymo_cancel(waymo_event_loop *loop, action_ticket ticket) {
+  if (ticket)
+    WAIT_COMPLETE(_send_command, loop, _create_cancel_cmd(loop, ticket));
+}
+
+/**
+ * @brief Stops every action in flight and lets go of every held key and button
+ * Actions that were waited on synchronously return with nothing left pressed.
+ * Key presses still waiting on a keymap upload are dropped, see waymo_cancel
+ * @param[in] loop Pointer to the event loop
+ */
+static inline void waymo_cancel_all(waymo_event_loop *loop) {
+  WAIT_COMPLETE(_send_command, loop, _create_cancel_cmd(loop, 0));
+}
+
+/**
+ * @brief A list of actions that is sent to the event loop in one go
+ */
+typedef _command waymo_batch;
+
+/**
+ * @brief Starts an empty batch
+ * Actions added to a batch are queued to the event loop as a single command
+ * and run in the order they were added, which avoids a queue handoff and a
+ * completion wait per action for long macros
+ * @return The batch or NULL if it could not be allocated
+ */
+static inline waymo_batch *waymo_batch_begin(void) {
+  return _create_batch_cmd();
+}
+
+/**
+ * @brief Adds a mouse move to a batch
+ * @param[in] batch    Pointer to the batch
+ * @param[in] x        X coordinate on the screen
+ * @param[in] y        Y coordinate on the screen
+ * @param[in] relative True if the coordinates should be relative to current
+ * coordinates
+ * @return False if the action could not be added
+ */
+static inline bool waymo_batch_move_mouse(waymo_batch *batch, unsigned int x,
+                                          unsigned int y, bool relative) {
+  return _batch_append(batch, _create_mouse_move_cmd(NULL, x, y, relative));
+}
+
+/**
+ * @brief Adds mouse clicks to a batch
+ * The next action in the batch starts once every click has been released
+ * @param[in] batch   Pointer to the batch
+ * @param[in] btn     Button to click from MBTNS enum (include btns.h)
+ * @param[in] clicks  The number of times to click
+ * @param[in] hold_ms The time in ms to hold the button down per click
+ * @return False if the action could not be added
+ */
+static inline bool waymo_batch_click_mouse(waymo_batch *batch, MBTNS btn,
+                                           unsigned int clicks,
+                                           uint32_t hold_ms) {
+  return _batch_append(batch,
+                       _create_mouse_click_cmd(NULL, btn, clicks, hold_ms));
+}
+
+/**
+ * @brief Adds a mouse button state change to a batch
+ * @param[in] batch Pointer to the batch
+ * @param[in] btn   Button to change from the MBTNS enum (include btns.h)
+ * @param[in] down  If the button should be down or up
+ * @return False if the action could not be added
+ */
+static inline bool waymo_batch_press_mouse(waymo_batch *batch, MBTNS btn,
+                                           bool down) {
+  return _batch_append(batch, _create_mouse_button_cmd(NULL, btn, down));
+}
+
+/**
+ * @brief Adds a key state change to a batch
+ * A key put down stays down after the batch completes, see press_key
+ * @param[in] batch       Pointer to the batch
+ * @param[in] key         The key to press
+ * @param[in] interval_ms A pointer to the ms between presses while down (NULL
+ * to leave repeating to the client)
+ * @param[in] down        If the key to be pressed should be down or not
+ * @return False if the action could not be added
+ */
+static inline bool waymo_batch_press_key(waymo_batch *batch, char key,
+                                         uint32_t *interval_ms, bool down) {
+  return _batch_append(
+      batch, _create_keyboard_key_cmd_b(NULL, key, interval_ms, down));
+}
+
+/**
+ * @brief Adds a timed key hold to a batch
+ * The next action in the batch starts once the hold is over
+ * @param[in] batch       Pointer to the batch
+ * @param[in] key         The key to press
+ * @param[in] interval_ms A pointer to the ms between each press (NULL for
+ * default)
+ * @param[in] hold_ms     How long the key should be held for in ms
+ * @return False if the action could not be added
+ */
+static inline bool waymo_batch_hold_key(waymo_batch *batch, char key,
+                                        uint32_t *interval_ms,
+                                        uint32_t hold_ms) {
+  return _batch_append(
+      batch, _create_keyboard_key_cmd_uintt(NULL, key, interval_ms, hold_ms));
+}
+
+/**
+ * @brief Adds a shortcut to a batch, see send_shortcut
+ * @param[in] batch Pointer to the batch
+ * @param[in] mods  Modifiers from the KMODS enum combined with |
+ * @param[in] key   The Unicode code point of the key
+ * @return False if the action could not be added
+ */
+static inline bool waymo_batch_send_shortcut(waymo_batch *batch,
+                                             unsigned int mods, uint32_t key) {
+  return _batch_append(batch, _create_keyboard_shortcut_cmd(NULL, mods, key));
+}
+
+/**
+ * @brief Adds typing a string to a batch
+ * The next action in the batch starts once the last character is typed
+ * @param[in] batch       Pointer to the batch
+ * @param[in] text        String to type out
+ * @param[in] interval_ms A pointer to the ms between each key being clicked
+ * (NULL for default)
+ * @return False if the action could not be added
+ */
+static inline bool waymo_batch_type(waymo_batch *batch, const char *text,
+                                    uint32_t *interval_ms) {
+  return _batch_append(batch,
+                       _create_keyboard_type_cmd(NULL, text, interval_ms));
+}
+
+/**
+ * @brief Runs every action in a batch and waits for the last one to finish
+ * The batch is consumed and must not be used afterwards
+ * @param[in] loop  Pointer to the event loop
+ * @param[in] batch Pointer to the batch
+ */
+static inline void waymo_batch_submit(waymo_event_loop *loop,
+                                      waymo_batch *batch) {
+  WAIT_COMPLETE(_send_command, loop, batch);
+}
+
+/**
+ * @brief Runs every action in a batch without waiting, see move_mouse_async
+ * The batch is consumed and must not be used afterwards
+ * @param[in] loop      Pointer to the event loop
+ * @param[in] batch     Pointer to the batch
+ * @param[in] cb        Called after the last action (NULL for none)
+ * @param[in] user_data Passed to cb
+ * @return The ticket of the batch or 0 if it could not be queued
+ */
+static inline action_ticket waymo_batch_submit_async(waymo_event_loop *loop,
+                                                     waymo_batch *batch,
+                                                     action_done_cb cb,
+                                                     void *user_data) {
+  return _send_command_async(loop, batch, cb, user_data);
+}
+
+/**
+ * @brief Frees a batch without running it
+ * @param[in] batch Pointer to the batch
+ */
+static inline void waymo_batch_discard(waymo_batch *batch) {
+  _discard_command(batch);
 }
 
 #ifdef __cplusplus
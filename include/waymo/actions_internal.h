@@ -13,37 +13,79 @@ extern "C" {
 
 typedef struct command _command;
 
-_command *_create_mouse_move_cmd(unsigned int x, unsigned int y, bool relative);
-_command *_create_mouse_click_cmd(MBTNS button, unsigned int clicks,
-                                  uint32_t click_ms);
-_command *_create_mouse_button_cmd(MBTNS button, bool down);
-
-_command *_create_keyboard_key_cmd_b(char key, uint32_t *interval_ms,
-                                     bool down);
-_command *_create_keyboard_key_cmd_uintt(char key, uint32_t *interval_ms,
+// Commands come from the loop's pool when it has one free, loop may be NULL to
+// always allocate from the heap
+_command *_create_mouse_move_cmd(waymo_event_loop *loop, unsigned int x,
+                                 unsigned int y, bool relative);
+_command *_create_mouse_click_cmd(waymo_event_loop *loop, MBTNS button,
+                                  unsigned int clicks, uint32_t click_ms);
+_command *_create_mouse_button_cmd(waymo_event_loop *loop, MBTNS button,
+                                   bool down);
+
+_command *_create_keyboard_key_cmd_b(waymo_event_loop *loop, char key,
+                                     uint32_t *interval_ms, bool down);
+_command *_create_keyboard_key_cmd_uintt(waymo_event_loop *loop, char key,
+                                         uint32_t *interval_ms,
                                          uint32_t hold_ms);
 
+// Same as the above for any Unicode code point rather than a single byte
+_command *_create_keyboard_codepoint_cmd_b(waymo_event_loop *loop,
+                                           uint32_t codepoint,
+                                           uint32_t *interval_ms, bool down);
+_command *_create_keyboard_codepoint_cmd_uintt(waymo_event_loop *loop,
+                                               uint32_t codepoint,
+                                               uint32_t *interval_ms,
+                                               uint32_t hold_ms);
+
+// Presses and releases codepoint with the KMODS in mods held around it
+_command *_create_keyboard_shortcut_cmd(waymo_event_loop *loop,
+                                        unsigned int mods, uint32_t codepoint);
+
 #ifndef __cplusplus
-#define _create_keyboard_key_cmd(key, interval, mutation)                      \
+#define _create_keyboard_key_cmd(loop, key, interval, mutation)                \
   _Generic((mutation),                                                         \
       bool: _create_keyboard_key_cmd_b,                                        \
-      uint32_t: _create_keyboard_key_cmd_uintt)((char)(key), (interval),       \
-                                                (mutation))
+      uint32_t: _create_keyboard_key_cmd_uintt)((loop), (char)(key),           \
+                                                (interval), (mutation))
 #endif
 
-_command *_create_keyboard_type_cmd(const char *text, uint32_t *interval_ms);
+_command *_create_keyboard_type_cmd(waymo_event_loop *loop, const char *text,
+                                    uint32_t *interval_ms);
+
+// Microsecond variants of the above
+_command *_create_mouse_click_cmd_us(waymo_event_loop *loop, MBTNS button,
+                                     unsigned int clicks, uint32_t click_us);
+_command *_create_keyboard_key_cmd_b_us(waymo_event_loop *loop, char key,
+                                        uint32_t *interval_us, bool down);
+_command *_create_keyboard_key_cmd_uintt_us(waymo_event_loop *loop, char key,
+                                            uint32_t *interval_us,
+                                            uint32_t hold_us);
+_command *_create_keyboard_type_cmd_us(waymo_event_loop *loop,
+                                       const char *text, uint32_t *interval_us);
+
+// Stops the actions of ticket, or every action when ticket is 0
+_command *_create_cancel_cmd(waymo_event_loop *loop, action_ticket ticket);
+
+_command *_create_batch_cmd();
+bool _batch_append(_command *batch, _command *cmd);
+void _discard_command(_command *cmd);
 
 void _send_command(waymo_event_loop *loop, _command *cmd, int fd);
+action_ticket _send_command_async(waymo_event_loop *loop, _command *cmd,
+                                  action_done_cb cb, void *user_data);
+
+// Eventfd owned by the calling thread, created on first use and closed when
+// the thread exits. Every submitted command signals it exactly once
+int _thread_done_fd();
 
 #define WAIT_COMPLETE(cmd_func, ...)                                           \
   do {                                                                         \
-    int efd = eventfd(0, EFD_CLOEXEC);                                         \
+    int efd = _thread_done_fd();                                               \
     if (efd != -1) {                                                           \
       cmd_func(__VA_ARGS__, efd);                                              \
       uint64_t res;                                                            \
       while (read(efd, &res, sizeof(res)) == -1 && errno == EINTR)             \
         ;                                                                      \
-      close(efd);                                                              \
     }                                                                          \
   } while (0)
 
@@ -15,4 +15,14 @@ typedef enum {
   MBTN_MID,
 } MBTNS;
 
+/**
+ * @brief Flags for the modifiers held during a shortcut, combine them with |
+ */
+typedef enum {
+  KMOD_SHIFT = 1 << 0,
+  KMOD_CTRL = 1 << 1,
+  KMOD_ALT = 1 << 2,
+  KMOD_SUPER = 1 << 3,
+} KMODS;
+
 #endif
@@ -11,6 +11,7 @@ extern "C" {
 #endif
 
 #include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /**
@@ -18,10 +19,52 @@ extern "C" {
  */
 typedef struct eloop_params {
   unsigned int max_commands;   /**< The max commands in the queue */
-  const char *kbd_layout;      /**< The layout of the keyboard */
-  uint32_t action_cooldown_ms; /**< Cooldown between each action */
+  /** XKB layout to type with, such as "us" or "de". Characters it cannot
+   * produce are added to the keymap as they are needed */
+  const char *kbd_layout;
+  /** Wait after an action completes before the next command starts, pending
+   * actions keep running meanwhile */
+  uint32_t action_cooldown_ms;
+  unsigned int ring_entries;   /**< Ring size, 0 disables the rings */
+  unsigned int command_pool;   /**< Pooled commands, 0 for 2 * max_commands */
+  unsigned int pending_pool;   /**< Pooled pending actions, 0 for 256 */
+  /** Most keys added for characters outside kbd_layout before the least
+   * recently used are recycled, 0 for no limit. Keys standing in for printable
+   * ASCII the layout lacks are always kept */
+  unsigned int keymap_capacity;
+  /** Most keys typed per tick by type with a zero interval, 0 for 32 */
+  unsigned int type_burst;
+  /** Keep the compiled kbd_layout under $XDG_CACHE_HOME/waymo and reuse it,
+   * which saves compiling it on every start. Stale entries are not detected
+   * after the system's XKB data changes, delete the directory then */
+  bool keymap_cache;
 } eloop_params;
 
+/**
+ * @brief Counters describing the work done by an event loop
+ */
+typedef struct eloop_stats {
+  uint64_t commands_submitted; /**< Commands accepted into the queue */
+  uint64_t queue_wakeups;      /**< Times a submission had to wake the loop */
+  uint64_t ring_submitted;     /**< Actions accepted into the ring */
+  uint64_t ring_wakeups;       /**< Ring submissions that woke the loop */
+  /** Most commands ever taken from the pool at once */
+  unsigned int command_pool_high_water;
+  /** Most pending actions ever taken from the pool at once */
+  unsigned int pending_pool_high_water;
+  uint64_t pool_misses; /**< Allocations that fell back to the heap */
+  uint64_t timer_fired; /**< Scheduled action steps that have run */
+  /** Sum of how late each step ran after its deadline */
+  uint64_t timer_late_ns;
+  uint64_t timer_max_late_ns; /**< Latest any single step has run */
+  /** Repeats dropped because the loop fell a whole interval behind */
+  uint64_t timer_skipped;
+  uint64_t keymap_uploads;      /**< Keymaps sent to the compositor */
+  uint64_t keymap_upload_bytes; /**< Total size of every keymap sent */
+  uint64_t keymap_last_upload_bytes; /**< Size of the latest keymap sent */
+  uint64_t keymap_evictions; /**< Keycodes recycled for new characters */
+} eloop_stats;
+
 typedef enum {
   STATUS_OK = 0,
   STATUS_INIT_FAILED = 1 << 0, // This error is fatal
@@ -31,6 +74,27 @@ typedef enum {
 
 typedef struct waymo_event_loop waymo_event_loop;
 
+/**
+ * @brief Identifies a submitted action, never 0 for an accepted action
+ */
+typedef uint64_t action_ticket;
+
+/**
+ * @brief How a submitted action finished
+ */
+typedef enum {
+  RESULT_DONE = 0,
+  RESULT_FAILED,    // The device was missing or the action could not be set up
+  RESULT_CANCELLED, // Stopped by waymo_cancel or waymo_cancel_all
+} action_result;
+
+/**
+ * @brief Called on the event loop thread once an async action finishes
+ * It must not block or call the synchronous APIs as that stalls the loop
+ */
+typedef void (*action_done_cb)(action_ticket ticket, action_result result,
+                               void *user_data);
+
 /**
  * @brief The function which creates an event loop
  * This function creates an event loop that can be used to send inputs
@@ -53,6 +117,16 @@ void destroy_event_loop(waymo_event_loop *loop);
  */
 loop_status get_event_loop_status(waymo_event_loop *loop);
 
+/**
+ * @brief Gets a snapshot of the event loop counters
+ * Submissions that arrive while the loop already has a wakeup pending do not
+ * signal it again, so queue_wakeups stays well below commands_submitted under
+ * bursty load
+ * @param[in]  loop  A pointer to the loop to be checked
+ * @param[out] stats Where the counters are written
+ */
+void get_event_loop_stats(waymo_event_loop *loop, eloop_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
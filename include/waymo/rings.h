@@ -0,0 +1,112 @@
+/**
+ * @file rings.h
+ * @brief Submission and completion rings for high rate callers
+ * Only available on loops created with eloop_params::ring_entries set
+ */
+
+#ifndef PRINGS_H
+#define PRINGS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "waymo/btns.h"
+#include "waymo/events.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The action a submission record describes
+ */
+typedef enum {
+  SQE_MOUSE_MOVE,
+  SQE_MOUSE_CLICK,
+  SQE_MOUSE_BTN,
+  SQE_KEYBOARD_KEY,  // Presses a key down or up
+  SQE_KEYBOARD_HOLD, // Holds a key down for hold_ms
+  SQE_KEYBOARD_TYPE,
+} sqe_op;
+
+/**
+ * @brief A fixed size action record written into the submission ring
+ * Intervals of 0 use the defaults the functions in actions.h take for a NULL
+ * interval, type.burst stands in for a zero one. Ring actions get no ticket
+ * so waymo_cancel cannot single them out, only waymo_cancel_all stops them,
+ * completing them with RESULT_CANCELLED
+ */
+typedef struct waymo_sqe {
+  sqe_op op;
+  union {
+    struct {
+      unsigned int x, y;
+      bool relative;
+    } move;
+    struct {
+      MBTNS button;
+      unsigned int clicks;
+      uint32_t hold_ms;
+    } click;
+    struct {
+      MBTNS button;
+      bool down;
+    } btn;
+    struct {
+      char key;
+      bool down;
+      uint32_t interval_ms;
+    } key;
+    struct {
+      char key;
+      uint32_t hold_ms;
+      uint32_t interval_ms;
+    } hold;
+    struct {
+      const char *text; // Must stay valid until the completion is reaped
+      uint32_t interval_ms;
+      // Ignores interval_ms and types in bursts, as type does with a zero
+      // interval since here 0 picks the default
+      bool burst;
+    } type;
+  };
+  uint64_t user_data; /**< Handed back untouched in the completion */
+} waymo_sqe;
+
+/**
+ * @brief A record posted to the completion ring once an action finishes
+ */
+typedef struct waymo_cqe {
+  uint64_t user_data; /**< The user_data of the finished submission */
+  action_result result;
+} waymo_cqe;
+
+/**
+ * @brief Copies actions into the submission ring
+ * No memory is allocated and the loop is only woken with a syscall when it is
+ * parked with nothing to do. Submission stops early when either ring is full,
+ * every accepted action posts exactly one completion
+ * @param[in] loop  Pointer to the event loop
+ * @param[in] sqes  The records to submit, copied before this returns
+ * @param[in] count The number of records
+ * @return The number of records accepted, from the start of sqes
+ */
+unsigned int waymo_ring_submit(waymo_event_loop *loop, const waymo_sqe *sqes,
+                               unsigned int count);
+
+/**
+ * @brief Takes finished actions off the completion ring without blocking
+ * This never makes a syscall. It can be called from any thread but the
+ * completions of all submitters share the one ring
+ * @param[in]  loop Pointer to the event loop
+ * @param[out] cqes Where the completions are written
+ * @param[in]  max  The most completions to take
+ * @return The number of completions written to cqes
+ */
+unsigned int waymo_ring_reap(waymo_event_loop *loop, waymo_cqe *cqes,
+                             unsigned int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
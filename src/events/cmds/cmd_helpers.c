@@ -1,11 +1,39 @@
 #include "events/commands.h"
+#include "events/pendings.h"
+#include "events/pool.h"
+#include "events/utf8.h"
 #include "utils.h"
+#include "waymo/rings.h"
 #include "wayland/waycon.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+
+// Takes a command from the loop's pool, falling back to the heap when there is
+// no loop or every pooled command is in flight
+static command *alloc_command(waymo_event_loop *loop) {
+  object_pool *pool = loop ? loop->cmd_pool : NULL;
+  command *cmd = pool ? pool_get(pool) : NULL;
+  if (likely(cmd)) {
+    cmd->pool = pool;
+    return cmd;
+  }
+  cmd = malloc(sizeof(command));
+  if (cmd)
+    cmd->pool = NULL;
+  return cmd;
+}
+
+static void dealloc_command(command *cmd) {
+  if (cmd->pool)
+    pool_put(cmd->pool, cmd);
+  else
+    free(cmd);
+}
 
 command *create_quit_cmd() {
-  command *cmd = malloc(sizeof(command));
+  command *cmd = alloc_command(NULL);
   if (!cmd)
     return NULL;
 
@@ -13,8 +41,9 @@ command *create_quit_cmd() {
   return cmd;
 }
 
-command *_create_mouse_move_cmd(unsigned int x, unsigned int y, bool relative) {
-  command *cmd = malloc(sizeof(command));
+command *_create_mouse_move_cmd(waymo_event_loop *loop, unsigned int x,
+                                unsigned int y, bool relative) {
+  command *cmd = alloc_command(loop);
   if (!cmd)
     return NULL;
 
@@ -23,21 +52,32 @@ command *_create_mouse_move_cmd(unsigned int x, unsigned int y, bool relative) {
   return cmd;
 }
 
-command *_create_mouse_click_cmd(MBTNS button, unsigned int clicks,
-                                 uint32_t click_ms) {
-  command *cmd = malloc(sizeof(command));
+static command *make_click_cmd(waymo_event_loop *loop, MBTNS button,
+                               unsigned int clicks, uint64_t click_ns) {
+  command *cmd = alloc_command(loop);
   if (!cmd)
     return NULL;
 
   cmd->type = CMD_MOUSE_CLICK;
   cmd->param = (command_param){.mouse_click = {.button = button,
                                                .clicks = clicks,
-                                               .click_ms = click_ms}};
+                                               .click_ns = click_ns}};
   return cmd;
 }
 
-command *_create_mouse_button_cmd(MBTNS button, bool down) {
-  command *cmd = malloc(sizeof(command));
+command *_create_mouse_click_cmd(waymo_event_loop *loop, MBTNS button,
+                                 unsigned int clicks, uint32_t click_ms) {
+  return make_click_cmd(loop, button, clicks, MS_TO_NS(click_ms));
+}
+
+command *_create_mouse_click_cmd_us(waymo_event_loop *loop, MBTNS button,
+                                    unsigned int clicks, uint32_t click_us) {
+  return make_click_cmd(loop, button, clicks, US_TO_NS(click_us));
+}
+
+command *_create_mouse_button_cmd(waymo_event_loop *loop, MBTNS button,
+                                  bool down) {
+  command *cmd = alloc_command(loop);
   if (!cmd)
     return NULL;
 
@@ -46,119 +86,574 @@ command *_create_mouse_button_cmd(MBTNS button, bool down) {
   return cmd;
 }
 
-command *_create_keyboard_key_cmd_b(char key, uint32_t *interval_ms,
-                                    bool down) {
-  command *cmd = malloc(sizeof(command));
+// Intervals are copied now since the caller may not outlive the command
+static command *make_key_cmd(waymo_event_loop *loop, uint32_t key,
+                             enum KMODOPT opt, uint64_t interval_ns,
+                             bool down, uint64_t hold_ns) {
+  command *cmd = alloc_command(loop);
   if (!cmd)
     return NULL;
 
   cmd->type = CMD_KEYBOARD_KEY;
-  cmd->param =
-      (command_param){.keyboard_key = {.key = key,
-                                       .active_opt = DOWN,
-                                       .interval_ms = interval_ms,
-                                       .keyboard_key_mod = {.down = down}}};
+  cmd->param = (command_param){
+      .keyboard_key = {.key = key,
+                       .active_opt = opt,
+                       .interval_ns = interval_ns}};
+  if (opt == DOWN)
+    cmd->param.keyboard_key.keyboard_key_mod.down = down;
+  else
+    cmd->param.keyboard_key.keyboard_key_mod.hold_ns = hold_ns;
   return cmd;
 }
 
-command *_create_keyboard_key_cmd_uintt(char key, uint32_t *interval_ms,
+command *_create_keyboard_key_cmd_b(waymo_event_loop *loop, char key,
+                                    uint32_t *interval_ms, bool down) {
+  return make_key_cmd(loop, (unsigned char)key, DOWN,
+                      MS_TO_NS(interval_ms ? *interval_ms
+                                           : DEFAULT_KEY_INTERVAL_MS),
+                      down, 0);
+}
+
+command *_create_keyboard_key_cmd_uintt(waymo_event_loop *loop, char key,
+                                        uint32_t *interval_ms,
                                         uint32_t hold_ms) {
-  command *cmd = malloc(sizeof(command));
+  return make_key_cmd(loop, (unsigned char)key, HOLD,
+                      MS_TO_NS(interval_ms ? *interval_ms
+                                           : DEFAULT_HOLD_INTERVAL_MS),
+                      false, MS_TO_NS(hold_ms));
+}
+
+command *_create_keyboard_key_cmd_b_us(waymo_event_loop *loop, char key,
+                                       uint32_t *interval_us, bool down) {
+  return make_key_cmd(loop, (unsigned char)key, DOWN,
+                      interval_us ? US_TO_NS(*interval_us)
+                                  : MS_TO_NS(DEFAULT_KEY_INTERVAL_MS),
+                      down, 0);
+}
+
+command *_create_keyboard_key_cmd_uintt_us(waymo_event_loop *loop, char key,
+                                           uint32_t *interval_us,
+                                           uint32_t hold_us) {
+  return make_key_cmd(loop, (unsigned char)key, HOLD,
+                      interval_us ? US_TO_NS(*interval_us)
+                                  : MS_TO_NS(DEFAULT_HOLD_INTERVAL_MS),
+                      false, US_TO_NS(hold_us));
+}
+
+command *_create_keyboard_codepoint_cmd_b(waymo_event_loop *loop,
+                                          uint32_t codepoint,
+                                          uint32_t *interval_ms, bool down) {
+  return make_key_cmd(loop, codepoint, DOWN,
+                      MS_TO_NS(interval_ms ? *interval_ms
+                                           : DEFAULT_KEY_INTERVAL_MS),
+                      down, 0);
+}
+
+command *_create_keyboard_codepoint_cmd_uintt(waymo_event_loop *loop,
+                                              uint32_t codepoint,
+                                              uint32_t *interval_ms,
+                                              uint32_t hold_ms) {
+  return make_key_cmd(loop, codepoint, HOLD,
+                      MS_TO_NS(interval_ms ? *interval_ms
+                                           : DEFAULT_HOLD_INTERVAL_MS),
+                      false, MS_TO_NS(hold_ms));
+}
+
+command *_create_cancel_cmd(waymo_event_loop *loop, action_ticket ticket) {
+  command *cmd = alloc_command(loop);
   if (!cmd)
     return NULL;
 
-  cmd->type = CMD_KEYBOARD_KEY;
-  cmd->param = (command_param){
-      .keyboard_key = {.key = key,
-                       .active_opt = HOLD,
-                       .interval_ms = interval_ms,
-                       .keyboard_key_mod = {.hold_ms = hold_ms}}};
+  cmd->type = CMD_CANCEL;
+  cmd->param = (command_param){.cancel = {.ticket = ticket}};
   return cmd;
 }
 
-command *_create_keyboard_type_cmd(const char *text, uint32_t *interval_ms) {
-  command *cmd = malloc(sizeof(command));
+command *_create_keyboard_shortcut_cmd(waymo_event_loop *loop,
+                                       unsigned int mods, uint32_t codepoint) {
+  command *cmd = alloc_command(loop);
   if (!cmd)
     return NULL;
 
-  char *txt = strdup(text);
-  if (!txt) {
-    free(cmd);
+  cmd->type = CMD_KEYBOARD_SHORTCUT;
+  cmd->param = (command_param){.shortcut = {.key = codepoint, .mods = mods}};
+  return cmd;
+}
+
+// The submitting thread decodes the text so the loop never has to
+static bool decode_text(const char *text, command_param *param) {
+  size_t len = strlen(text);
+  param->kbd.cps = malloc((len ? len : 1) * sizeof(uint32_t));
+  if (!param->kbd.cps)
+    return false;
+  param->kbd.len = utf8_decode(text, len, param->kbd.cps);
+  return true;
+}
+
+static command *make_type_cmd(waymo_event_loop *loop, const char *text,
+                              uint64_t interval_ns) {
+  command *cmd = alloc_command(loop);
+  if (!cmd)
     return NULL;
-  }
 
   cmd->type = CMD_KEYBOARD_TYPE;
-  cmd->param = (command_param){.kbd = {.txt = txt, .interval_ms = interval_ms}};
+  cmd->param = (command_param){.kbd = {.interval_ns = interval_ns}};
+  if (!decode_text(text, &cmd->param)) {
+    dealloc_command(cmd);
+    return NULL;
+  }
   return cmd;
 }
 
-void free_command(command *cmd) {
+command *_create_keyboard_type_cmd(waymo_event_loop *loop, const char *text,
+                                   uint32_t *interval_ms) {
+  return make_type_cmd(
+      loop, text,
+      MS_TO_NS(interval_ms ? *interval_ms : DEFAULT_TYPE_INTERVAL_MS));
+}
+
+command *_create_keyboard_type_cmd_us(waymo_event_loop *loop, const char *text,
+                                      uint32_t *interval_us) {
+  return make_type_cmd(loop, text,
+                       interval_us ? US_TO_NS(*interval_us)
+                                   : MS_TO_NS(DEFAULT_TYPE_INTERVAL_MS));
+}
+
+command *_create_batch_cmd() {
+  command *cmd = alloc_command(NULL);
   if (!cmd)
-    return;
+    return NULL;
+
+  cmd->type = CMD_BATCH;
+  cmd->param = (command_param){.batch = {.cmds = NULL, .len = 0, .cap = 0}};
+  return cmd;
+}
+
+bool _batch_append(command *batch, command *cmd) {
+  if (unlikely(!batch || !cmd || batch->type != CMD_BATCH)) {
+    free_command(cmd);
+    return false;
+  }
 
+  if (batch->param.batch.len == batch->param.batch.cap) {
+    size_t cap = batch->param.batch.cap ? batch->param.batch.cap * 2 : 16;
+    command **cmds = realloc(batch->param.batch.cmds, cap * sizeof(command *));
+    if (!cmds) {
+      free_command(cmd);
+      return false;
+    }
+    batch->param.batch.cmds = cmds;
+    batch->param.batch.cap = cap;
+  }
+  batch->param.batch.cmds[batch->param.batch.len++] = cmd;
+  return true;
+}
+
+void _discard_command(command *cmd) { free_command(cmd); }
+
+bool command_from_sqe(const waymo_sqe *sqe, command *cmd) {
+  cmd->pool = NULL;
+  switch (sqe->op) {
+  case SQE_MOUSE_MOVE:
+    cmd->type = CMD_MOUSE_MOVE;
+    cmd->param = (command_param){.pos = {.x = sqe->move.x,
+                                         .y = sqe->move.y,
+                                         .relative = sqe->move.relative}};
+    break;
+  case SQE_MOUSE_CLICK:
+    cmd->type = CMD_MOUSE_CLICK;
+    cmd->param = (command_param){
+        .mouse_click = {.button = sqe->click.button,
+                        .clicks = sqe->click.clicks,
+                        .click_ns = MS_TO_NS(sqe->click.hold_ms)}};
+    break;
+  case SQE_MOUSE_BTN:
+    cmd->type = CMD_MOUSE_BTN;
+    cmd->param = (command_param){
+        .mouse_btn = {.button = sqe->btn.button, .down = sqe->btn.down}};
+    break;
+  case SQE_KEYBOARD_KEY:
+    cmd->type = CMD_KEYBOARD_KEY;
+    cmd->param = (command_param){
+        .keyboard_key = {.key = (unsigned char)sqe->key.key,
+                         .active_opt = DOWN,
+                         .interval_ns = MS_TO_NS(sqe->key.interval_ms
+                                                     ? sqe->key.interval_ms
+                                                     : DEFAULT_KEY_INTERVAL_MS),
+                         .keyboard_key_mod = {.down = sqe->key.down}}};
+    break;
+  case SQE_KEYBOARD_HOLD:
+    cmd->type = CMD_KEYBOARD_KEY;
+    cmd->param = (command_param){
+        .keyboard_key = {
+            .key = (unsigned char)sqe->hold.key,
+            .active_opt = HOLD,
+            .interval_ns = MS_TO_NS(sqe->hold.interval_ms
+                                        ? sqe->hold.interval_ms
+                                        : DEFAULT_HOLD_INTERVAL_MS),
+            .keyboard_key_mod = {.hold_ns = MS_TO_NS(sqe->hold.hold_ms)}}};
+    break;
+  case SQE_KEYBOARD_TYPE:
+    if (!sqe->type.text)
+      return false;
+    // ekbd_type normally takes the decoded text, clear_command frees it if not
+    cmd->type = CMD_KEYBOARD_TYPE;
+    cmd->param = (command_param){
+        .kbd = {.interval_ns = MS_TO_NS(sqe->type.interval_ms
+                                            ? sqe->type.interval_ms
+                                            : DEFAULT_TYPE_INTERVAL_MS)}};
+    // A zero interval_ms is the default, so bursts are asked for apart
+    if (sqe->type.burst)
+      cmd->param.kbd.interval_ns = 0;
+    if (!decode_text(sqe->type.text, &cmd->param))
+      return false;
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+void clear_command(command *cmd) {
   switch (cmd->type) {
   case CMD_KEYBOARD_TYPE:
-    free(cmd->param.kbd.txt);
-    cmd->param.kbd.txt = NULL;
+    free(cmd->param.kbd.cps);
+    cmd->param.kbd.cps = NULL;
+    break;
+  case CMD_BATCH:
+    for (size_t i = 0; i < cmd->param.batch.len; i++)
+      free_command(cmd->param.batch.cmds[i]);
+    free(cmd->param.batch.cmds);
+    cmd->param.batch.cmds = NULL;
     break;
   default:
     break;
   }
-  free(cmd);
-  cmd = NULL;
 }
 
-void _send_command(waymo_event_loop *loop, command *cmd, int fd) {
-  if (unlikely(!loop || !cmd))
+void free_command(command *cmd) {
+  if (!cmd)
     return;
+  clear_command(cmd);
+  dealloc_command(cmd);
+}
 
-  cmd->done_fd = fd;
-
+static action_ticket submit_command(waymo_event_loop *loop, command *cmd,
+                                    completion done) {
+  done.ticket = atomic_fetch_add_explicit(&loop->next_ticket, 1,
+                                          memory_order_relaxed);
+  cmd->done = done;
   if (!add_queue(loop->queue, cmd)) {
     // Queue is full or shutting down
     free_command(cmd);
+    return 0;
+  }
+  return done.ticket;
+}
+
+void _send_command(waymo_event_loop *loop, command *cmd, int fd) {
+  // Wake the caller rather than leave it waiting on a command that never ran
+  if (unlikely(!loop || !cmd)) {
+    free_command(cmd);
+    signal_done(fd);
+    return;
+  }
+  if (!submit_command(loop, cmd, (completion){.fd = fd}))
+    signal_done(fd);
+}
+
+action_ticket _send_command_async(waymo_event_loop *loop, command *cmd,
+                                  action_done_cb cb, void *user_data) {
+  if (unlikely(!loop || !cmd)) {
+    free_command(cmd);
+    return 0;
+  }
+  return submit_command(
+      loop, cmd, (completion){.fd = -1, .cb = cb, .user_data = user_data});
+}
+
+static pthread_key_t done_fd_key;
+static pthread_once_t done_fd_once = PTHREAD_ONCE_INIT;
+static _Thread_local int thread_done_fd = -1;
+
+static void close_done_fd(void *fd) {
+  // Stored off by one since a NULL value never reaches the destructor
+  close((int)((intptr_t)fd - 1));
+}
+
+static void make_done_fd_key() {
+  pthread_key_create(&done_fd_key, close_done_fd);
+}
+
+int _thread_done_fd() {
+  if (likely(thread_done_fd >= 0))
+    return thread_done_fd;
+
+  int fd = eventfd(0, EFD_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  pthread_once(&done_fd_once, make_done_fd_key);
+  pthread_setspecific(done_fd_key, (void *)((intptr_t)fd + 1));
+  thread_done_fd = fd;
+  return fd;
+}
+
+// A batch that has been handed to the loop thread, owns its remaining commands
+struct batch_run {
+  command **cmds;
+  size_t len;
+  size_t next;
+  bool running;   // Inside execute_command for cmds[next]
+  bool step_done; // cmds[next] finished before execute_command returned
+  action_result result;
+  completion done;
+  // While held, waymoctx::staged_seq when cmds[next] finished and the next
+  // batch held in loop->held_batches
+  uint64_t staged;
+  struct batch_run *next_held;
+};
+
+static void run_batch(waymo_event_loop *loop, waymoctx *ctx,
+                      struct batch_run *run) {
+  // Steps that finish synchronously are looped over here rather than resumed
+  // from signal_completion so long batches do not recurse
+  while (run->next < run->len) {
+    command *step = run->cmds[run->next];
+    run->cmds[run->next] = NULL;
+    step->done = (completion){.fd = -1, .batch = run};
+
+    run->step_done = false;
+    run->running = true;
+    execute_command(loop, ctx, step);
+    run->running = false;
+    free_command(step);
+
+    if (!run->step_done)
+      return; // Resumed once the step's pending actions complete
+    run->next++;
+  }
+
+  completion done = run->done;
+  action_result result = run->result;
+  free(run->cmds);
+  free(run);
+  signal_completion(loop, ctx, done, result);
+}
+
+static void execute_batch(waymo_event_loop *loop, waymoctx *ctx,
+                          command *cmd) {
+  struct batch_run *run = malloc(sizeof(struct batch_run));
+  if (!run) {
+    signal_completion(loop, ctx, cmd->done, RESULT_FAILED);
+    return;
+  }
+
+  // Take the commands so the caller's free_command leaves them alone
+  *run = (struct batch_run){.cmds = cmd->param.batch.cmds,
+                            .len = cmd->param.batch.len,
+                            .result = RESULT_DONE,
+                            .done = cmd->done};
+  cmd->param.batch.cmds = NULL;
+  cmd->param.batch.len = 0;
+  run_batch(loop, ctx, run);
+}
+
+static void deliver_completion(waymo_event_loop *loop, completion done,
+                               action_result result) {
+  if (done.cb)
+    done.cb(done.ticket, result, done.user_data);
+  if (done.post_cqe) {
+    // Cannot fail, submission never lets more actions in flight than the
+    // completion ring holds
+    waymo_cqe cqe = {.user_data = done.cqe_data, .result = result};
+    push_ring(loop->cq, &cqe);
+  }
+  signal_done(done.fd);
+}
+
+static void hold_batch(waymo_event_loop *loop, struct batch_run *run) {
+  struct batch_run **tail = &loop->held_batches;
+  while (*tail)
+    tail = &(*tail)->next_held;
+  run->next_held = NULL;
+  *tail = run;
+}
+
+// Moves every held batch whose keys have gone out on to its next step
+static void resume_batches(waymo_event_loop *loop, waymoctx *ctx) {
+  // Taken whole first, a step that stages keys again holds its batch anew
+  struct batch_run *run = loop->held_batches;
+  loop->held_batches = NULL;
+  while (run) {
+    struct batch_run *next = run->next_held;
+    if (run->staged > ctx->unstaged_seq) {
+      hold_batch(loop, run);
+    } else {
+      run->next++;
+      run_batch(loop, ctx, run);
+    }
+    run = next;
+  }
+}
+
+bool cancel_held_batches(waymo_event_loop *loop, waymoctx *ctx,
+                         action_ticket ticket) {
+  bool found = false;
+  struct batch_run **link = &loop->held_batches;
+  while (*link) {
+    struct batch_run *run = *link;
+    if (ticket && completion_ticket(run->done) != ticket) {
+      link = &run->next_held;
+      continue;
+    }
+    *link = run->next_held;
+    found = true;
+    signal_completion(loop, ctx,
+                      release_completion((completion){.batch = run}),
+                      RESULT_CANCELLED);
+  }
+  return found;
+}
+
+void signal_completion(waymo_event_loop *loop, waymoctx *ctx,
+                       completion done, action_result result) {
+  if (done.batch) {
+    struct batch_run *run = done.batch;
+    // A failed step fails the batch but the remaining steps still run
+    if (result != RESULT_DONE)
+      run->result = result;
+    // Staged keys wait for a keymap upload to be confirmed but pointer
+    // requests go straight to the socket, so a step after them could
+    // overtake them. The batch goes on once they have been sent
+    if (ctx && ctx->staged_seq > ctx->unstaged_seq) {
+      run->staged = ctx->staged_seq;
+      hold_batch(loop, run);
+      return;
+    }
+    if (run->running) {
+      run->step_done = true;
+      return;
+    }
+    run->next++;
+    run_batch(loop, ctx, run);
+    return;
+  }
+  // The loop takes no new commands until the cooldown has passed
+  if (loop->cooldown_ns)
+    loop->cooldown_until_ns = timestamp_ns() + loop->cooldown_ns;
+  // Without a connection nothing was sent that has to be flushed first
+  if (!ctx) {
+    deliver_completion(loop, done, result);
+    return;
+  }
+
+  // Whoever is told the action is done may act on it straight away, so it is
+  // held back until its requests are on the socket. A round trip is not needed
+  if (loop->finished_len == loop->finished_cap) {
+    size_t cap = loop->finished_cap ? loop->finished_cap * 2 : 16;
+    finished_action *finished =
+        realloc(loop->finished, cap * sizeof(finished_action));
+    if (!finished) {
+      // Pay for a flush of its own rather than lose the completion
+      deliver_completion(loop, done,
+                         waymoctx_commit(ctx) ? result : RESULT_FAILED);
+      return;
+    }
+    loop->finished = finished;
+    loop->finished_cap = cap;
+  }
+  loop->finished[loop->finished_len++] = (finished_action){
+      .done = done, .result = result, .staged = ctx->staged_seq};
+}
+
+void deliver_finished(waymo_event_loop *loop, waymoctx *ctx, bool sent) {
+  // Keys of a finished action may still be staged behind a keymap upload,
+  // its caller hears about it once they have gone out too. Anything that
+  // finished before them is told right away. Stamps only grow, so the
+  // completions kept are always the newest and stay in order
+  size_t kept = 0;
+  // Callbacks cannot complete further actions so the list stays put
+  for (size_t i = 0; i < loop->finished_len; i++) {
+    finished_action *f = &loop->finished[i];
+    if (sent && f->staged > ctx->unstaged_seq)
+      loop->finished[kept++] = *f;
+    else
+      deliver_completion(loop, f->done, sent ? f->result : RESULT_FAILED);
+  }
+  loop->finished_len = kept;
+}
+
+void flush_tick(waymo_event_loop *loop, waymoctx *ctx) {
+  resume_batches(loop, ctx);
+  deliver_finished(loop, ctx, waymoctx_commit(ctx));
+}
+
+completion release_completion(completion done) {
+  // Used when work is dropped, the steps left in its batches never run
+  while (done.batch) {
+    struct batch_run *run = done.batch;
+    done = run->done;
+    for (size_t i = run->next; i < run->len; i++)
+      free_command(run->cmds[i]);
+    free(run->cmds);
+    free(run);
   }
+  return done;
+}
+
+action_ticket completion_ticket(completion done) {
+  while (done.batch)
+    done = done.batch->done;
+  return done.ticket;
 }
 
 void execute_command(waymo_event_loop *loop, waymoctx *ctx, command *cmd) {
   if (!ctx || !cmd)
     return;
 
+  // Every branch must complete the command exactly once, even when the device
+  // is missing, so waiting callers and batches are never left hanging
   switch (cmd->type) {
   case CMD_MOUSE_MOVE:
-    if (!ctx->ptr)
-      break;
-    emouse_move(ctx, &cmd->param);
-    signal_done(cmd->done_fd, loop->action_cooldown_ms);
+    if (ctx->ptr)
+      emouse_move(ctx, &cmd->param);
+    signal_completion(loop, ctx, cmd->done,
+                      ctx->ptr ? RESULT_DONE : RESULT_FAILED);
     break;
   case CMD_MOUSE_CLICK:
-    if (!ctx->ptr)
-      break;
-    emouse_click(loop, ctx, &cmd->param, cmd->done_fd);
+    emouse_click(loop, ctx, &cmd->param, cmd->done);
     break;
   case CMD_MOUSE_BTN:
-    if (!ctx->ptr)
-      break;
-    emouse_btn(ctx, &cmd->param);
-    signal_done(cmd->done_fd, loop->action_cooldown_ms);
+    if (ctx->ptr)
+      emouse_btn(loop, ctx, &cmd->param);
+    signal_completion(loop, ctx, cmd->done,
+                      ctx->ptr ? RESULT_DONE : RESULT_FAILED);
     break;
   case CMD_KEYBOARD_TYPE:
-    if (!ctx->kbd)
-      break;
-    ekbd_type(loop, ctx, &cmd->param, cmd->done_fd);
+    ekbd_type(loop, ctx, &cmd->param, cmd->done);
     break;
   case CMD_KEYBOARD_KEY:
-    if (!ctx->kbd)
-      break;
-    ekbd_key(loop, ctx, &cmd->param, cmd->done_fd);
+    ekbd_key(loop, ctx, &cmd->param, cmd->done);
+    break;
+  case CMD_KEYBOARD_SHORTCUT:
+    ekbd_shortcut(loop, ctx, &cmd->param, cmd->done);
+    break;
+  case CMD_BATCH:
+    execute_batch(loop, ctx, cmd);
     break;
+  case CMD_CANCEL: {
+    // Neither the cancel nor what it stopped counts as an action finishing,
+    // so the cooldown is left where it was
+    uint64_t cooldown_until_ns = loop->cooldown_until_ns;
+    signal_completion(loop, ctx, cmd->done,
+                      cancel_actions(loop, ctx, cmd->param.cancel.ticket)
+                          ? RESULT_DONE
+                          : RESULT_FAILED);
+    loop->cooldown_until_ns = cooldown_until_ns;
+    break;
+  }
   default:
+    signal_completion(loop, ctx, cmd->done, RESULT_FAILED);
     break;
   }
-
-  int ret;
-  while ((ret = wl_display_flush(ctx->display)) > 0)
-    ;
-  if (ret < 0)
-    return;
 }
@@ -0,0 +1,69 @@
+#include "events/utf8.h"
+#include "utils.h"
+#include <string.h>
+
+#define HIGH_BITS 0x8080808080808080ULL
+
+// Length of the sequence starting at s and its code point in cp, or 0 if the
+// bytes are not valid UTF-8. Overlong forms, surrogates and anything past
+// U+10FFFF are rejected
+static size_t decode_one(const unsigned char *s, size_t left, uint32_t *cp) {
+  unsigned char b = s[0];
+  size_t n;
+  uint32_t c, min;
+  if (b >= 0xc2 && b <= 0xdf) {
+    n = 2, c = b & 0x1f, min = 0x80;
+  } else if (b >= 0xe0 && b <= 0xef) {
+    n = 3, c = b & 0x0f, min = 0x800;
+  } else if (b >= 0xf0 && b <= 0xf4) {
+    n = 4, c = b & 0x07, min = 0x10000;
+  } else {
+    return 0;
+  }
+  if (n > left)
+    return 0;
+
+  for (size_t i = 1; i < n; i++) {
+    if ((s[i] & 0xc0) != 0x80)
+      return 0;
+    c = (c << 6) | (s[i] & 0x3f);
+  }
+  if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+    return 0;
+  *cp = c;
+  return n;
+}
+
+size_t utf8_decode(const char *s, size_t len, uint32_t *out) {
+  const unsigned char *p = (const unsigned char *)s;
+  size_t i = 0, n = 0;
+  while (i < len) {
+    // Most text is ASCII, so widen eight bytes at a time while none of them
+    // has the high bit set
+    while (i + 8 <= len) {
+      uint64_t w;
+      memcpy(&w, p + i, sizeof(w));
+      if (w & HIGH_BITS)
+        break;
+      for (size_t k = 0; k < 8; k++)
+        out[n + k] = p[i + k];
+      i += 8;
+      n += 8;
+    }
+    if (i >= len)
+      break;
+
+    if (p[i] < 0x80) {
+      out[n++] = p[i++];
+      continue;
+    }
+    size_t used = decode_one(p + i, len - i, &out[n]);
+    if (unlikely(!used)) {
+      out[n] = p[i];
+      used = 1;
+    }
+    i += used;
+    n++;
+  }
+  return n;
+}
@@ -1,5 +1,8 @@
 #include "events/pendings.h"
 #include "events/queue.h"
+#include "events/ring.h"
+#include "utils.h"
+#include "waymo/rings.h"
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,10 +10,96 @@
 #include <sys/timerfd.h>
 #include <unistd.h>
 
+static bool cooling_down(waymo_event_loop *loop) {
+  return loop->cooldown_ns && timestamp_ns() < loop->cooldown_until_ns;
+}
+
+// Holds back the queue and ring until the cooldown is over. The loop keeps
+// running pending actions and Wayland events meanwhile, timer_fd wakes it
+static void defer_intake(waymo_event_loop *loop) {
+  if (loop->intake_deferred)
+    return;
+  loop->intake_deferred = true;
+  pthread_mutex_lock(&loop->pending_mutex);
+  update_timer(loop);
+  pthread_mutex_unlock(&loop->pending_mutex);
+}
+
+// Cancels are not actions so the cooldown does not hold them back, though
+// they still never overtake the commands queued before them
+static void drain_cancels(waymo_event_loop *loop, waymoctx *ctx) {
+  command *cmd;
+  while ((cmd = peek_queue(loop->queue)) && cmd->type == CMD_CANCEL) {
+    remove_queue(loop->queue);
+    execute_command(loop, ctx, cmd);
+    free_command(cmd);
+  }
+  // Nothing behind the head can run before the cooldown is over either
+  if (cmd)
+    hold_queue(loop->queue);
+}
+
+// Returns false once the loop should exit
+static bool drain_queue(waymo_event_loop *loop, waymoctx *ctx) {
+  command *cmd;
+  while (!cooling_down(loop) && (cmd = remove_queue(loop->queue))) {
+    if (cmd->type == CMD_QUIT) {
+      free_command(cmd);
+      return false;
+    }
+    execute_command(loop, ctx, cmd);
+    free_command(cmd);
+  }
+  if (cooling_down(loop)) {
+    drain_cancels(loop, ctx);
+    defer_intake(loop);
+  }
+  return true;
+}
+
+static void drain_ring(waymo_event_loop *loop, waymoctx *ctx) {
+  // Bounded so a busy submitter cannot starve Wayland dispatch, anything left
+  // over keeps the loop from parking
+  waymo_sqe sqe;
+  for (unsigned int i = 0; i < loop->sq->entries; i++) {
+    if (cooling_down(loop)) {
+      defer_intake(loop);
+      return;
+    }
+    if (!pop_ring(loop->sq, &sqe))
+      return;
+    command cmd;
+    completion done = {.fd = -1, .post_cqe = true, .cqe_data = sqe.user_data};
+    if (!command_from_sqe(&sqe, &cmd)) {
+      signal_completion(loop, ctx, done, RESULT_FAILED);
+      continue;
+    }
+    cmd.done = done;
+    execute_command(loop, ctx, &cmd);
+    clear_command(&cmd);
+  }
+}
+
+// Tells the callers of whatever never reached execute_command that it was
+// cancelled. New commands are refused from here on
+static void cancel_queued(waymo_event_loop *loop, waymoctx *ctx) {
+  atomic_store(&loop->queue->shutdown, true);
+  command *cmd;
+  while ((cmd = remove_queue(loop->queue))) {
+    signal_completion(loop, ctx, cmd->done, RESULT_CANCELLED);
+    free_command(cmd);
+  }
+  waymo_sqe sqe;
+  while (loop->sq && pop_ring(loop->sq, &sqe)) {
+    completion done = {.fd = -1, .post_cqe = true, .cqe_data = sqe.user_data};
+    signal_completion(loop, ctx, done, RESULT_CANCELLED);
+  }
+}
+
 void *event_loop(void *arg) {
   waymo_event_loop *loop = (waymo_event_loop *)arg;
 
-  waymoctx *ctx = init_waymoctx(loop->kbd_layout, &loop->status);
+  waymoctx *ctx = init_waymoctx(loop);
   sem_post(&loop->ready_sem);
   if (!ctx)
     return NULL;
@@ -32,24 +121,42 @@ void *event_loop(void *arg) {
     goto loop_exit;
   if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, loop->timer_fd, &ev_timer) == -1)
     goto loop_exit;
+  if (loop->sq) {
+    struct epoll_event ev_ring = {.events = EPOLLIN, .data.fd = loop->sq->fd};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, loop->sq->fd, &ev_ring) == -1)
+      goto loop_exit;
+  }
 
-#define EVENTS_NUM 3
+#define EVENTS_NUM 4
 
   struct epoll_event events[EVENTS_NUM];
 
   while (true) {
+    if (loop->sq && !loop->intake_deferred)
+      drain_ring(loop, ctx);
+
     // Dispatch any internal Wayland events before sleeping
     while (wl_display_prepare_read(ctx->display) != 0) {
       wl_display_dispatch_pending(ctx->display);
     }
-    wl_display_flush(ctx->display);
+    // Keymap confirmations are read in along with everything else
+    waymoctx_dispatch_kbd(ctx);
+    // The one flush per tick, nobody hears about an action before it is sent
+    flush_tick(loop, ctx);
 
-    int nfds =
-        epoll_wait(epoll_fd, events, EVENTS_NUM, -1); // Block until event
+    // Ring submitters only pay for a wakeup while the loop is parked here.
+    // During a cooldown the timer wakes the loop instead
+    int timeout = -1;
+    if (loop->sq && !loop->intake_deferred && !park_ring(loop->sq))
+      timeout = 0;
+    int nfds = epoll_wait(epoll_fd, events, EVENTS_NUM, timeout);
+    if (loop->sq)
+      unpark_ring(loop->sq);
     if (nfds < 0 && errno != EINTR)
       break;
 
     bool wayland_ready = false;
+    bool resume_intake = false;
     for (int i = 0; i < nfds; i++) {
       if (events[i].data.fd == wayland_fd) {
         if (events[i].events & (EPOLLERR | EPOLLHUP)) {
@@ -58,26 +165,33 @@ void *event_loop(void *arg) {
         }
         wayland_ready = true;
       } else if (events[i].data.fd == loop->queue->fd) {
-        // Clear eventfd signal
-        uint64_t u;
-        if (read(loop->queue->fd, &u, sizeof(uint64_t)) == -1)
-          goto loop_exit;
-
-        command *cmd;
-        while ((cmd = remove_queue(loop->queue))) {
-          if (cmd->type == CMD_QUIT) {
-            free_command(cmd);
+        if (loop->intake_deferred) {
+          // Only a cancel at the head runs before the cooldown ends
+          if (!ack_queue(loop->queue))
             goto loop_exit;
-          }
-          execute_command(loop, ctx, cmd);
-          free_command(cmd);
+          drain_cancels(loop, ctx);
+          continue;
         }
+        // Clear eventfd signal and re-arm it for the next producer
+        if (!ack_queue(loop->queue))
+          goto loop_exit;
+        if (!drain_queue(loop, ctx))
+          goto loop_exit;
       } else if (events[i].data.fd == loop->timer_fd) {
         uint64_t expirations;
         if (read(loop->timer_fd, &expirations, sizeof(uint64_t)) == -1) {
           goto loop_exit;
         }
+        // Cleared first so the timer is not re-armed for a passed cooldown
+        if (loop->intake_deferred && !cooling_down(loop)) {
+          loop->intake_deferred = false;
+          resume_intake = true;
+        }
         handle_timer_expiry(loop, ctx);
+      } else if (loop->sq && events[i].data.fd == loop->sq->fd) {
+        // The ring itself is drained at the top of the loop
+        if (!ack_ring(loop->sq))
+          goto loop_exit;
       }
     }
 
@@ -87,10 +201,21 @@ void *event_loop(void *arg) {
       wl_display_cancel_read(ctx->display);
     }
     wl_display_dispatch_pending(ctx->display);
-    wl_display_roundtrip(ctx->display);
+
+    // Commands that arrived during the cooldown, the ring is drained at the
+    // top of the loop
+    if (resume_intake &&
+        (!ack_queue(loop->queue) || !drain_queue(loop, ctx)))
+      break;
   }
 
 loop_exit:
+  // Nothing is left to run what is in flight or queued
+  cancel_actions(loop, ctx, 0);
+  cancel_queued(loop, ctx);
+  // Callers of finished actions are still waiting on them
+  waymoctx_unstage_keys(ctx);
+  flush_tick(loop, ctx);
   if (epoll_fd >= 0)
     close(epoll_fd);
   if (loop->timer_fd >= 0)
@@ -100,10 +225,30 @@ loop_exit:
   return NULL;
 }
 
+// Frees everything the loop owns besides the thread and its mutex. The queue
+// goes first since the commands left in it belong to the command pool
+static void free_loop(waymo_event_loop *loop) {
+  if (loop->queue)
+    destroy_queue(loop->queue);
+  destroy_ring(loop->sq);
+  destroy_ring(loop->cq);
+  destroy_pool(loop->cmd_pool);
+  destroy_pool(loop->pending_pool);
+  free(loop->finished);
+  free(loop->kbd_layout);
+  free(loop);
+}
+
 waymo_event_loop *create_event_loop(const struct eloop_params *params) {
   const char *layout = "us";
   unsigned int max_cmds = 50;
   uint32_t action_cooldown_ms = 0;
+  unsigned int ring_entries = 0;
+  unsigned int cmd_pool = 0;
+  unsigned int pending_pool = 0;
+  unsigned int keymap_capacity = 0;
+  unsigned int type_burst = 0;
+  bool keymap_cache = false;
 
   if (params) {
     // Only override if the user provided valid values
@@ -112,43 +257,89 @@ waymo_event_loop *create_event_loop(const struct eloop_params *params) {
     }
     max_cmds = params->max_commands;
     action_cooldown_ms = params->action_cooldown_ms;
+    ring_entries = params->ring_entries;
+    cmd_pool = params->command_pool;
+    pending_pool = params->pending_pool;
+    keymap_capacity = params->keymap_capacity;
+    type_burst = params->type_burst;
+    keymap_cache = params->keymap_cache;
   }
+  // Enough for a full queue plus as many commands again being built
+  if (!cmd_pool)
+    cmd_pool = max_cmds * 2;
+  if (!pending_pool)
+    pending_pool = 256;
+  // At worst a character is a press and release of 20 bytes each between two
+  // 24 byte modifiers changes, 88 bytes on the wire. A default burst of those
+  // is 2.8 KiB, which leaves libwayland's 4 KiB output buffer room to spare
+  if (!type_burst)
+    type_burst = 32;
 
   waymo_event_loop *loop = malloc(sizeof(waymo_event_loop));
   if (!loop)
     return NULL;
 
+  // Set before anything can fail, free_loop releases it
+  loop->finished = NULL;
+  loop->finished_len = 0;
+  loop->finished_cap = 0;
+  loop->held_batches = NULL;
   loop->kbd_layout = strdup(layout);
   loop->queue = create_queue(max_cmds);
-  loop->action_cooldown_ms = action_cooldown_ms;
-  if (!loop->queue || !loop->kbd_layout) {
-    free(loop->kbd_layout);
-    if (loop->queue)
-      destroy_queue(loop->queue);
-    free(loop);
+  loop->cooldown_ns = MS_TO_NS(action_cooldown_ms);
+  loop->cooldown_until_ns = 0;
+  loop->intake_deferred = false;
+  // The completion ring is twice the size so submissions can run ahead of
+  // callers reaping
+  loop->sq = ring_entries ? create_ring(ring_entries, sizeof(waymo_sqe), true)
+                          : NULL;
+  loop->cq = ring_entries
+                 ? create_ring(ring_entries * 2, sizeof(waymo_cqe), false)
+                 : NULL;
+  // A missing pool only means allocating from the heap so it is not fatal
+  loop->cmd_pool = create_pool(cmd_pool, sizeof(command));
+  loop->pending_pool = create_pool(pending_pool, sizeof(struct pending_action));
+  if (!loop->queue || !loop->kbd_layout ||
+      (ring_entries && (!loop->sq || !loop->cq))) {
+    free_loop(loop);
     return NULL;
   }
 
   loop->timer_fd = -1;
-  loop->pending_head = NULL;
+  loop->pending = NULL;
+  loop->pending_len = 0;
+  loop->pending_cap = 0;
+  loop->pending_seq = 0;
+  loop->tickets = (u64_map){0};
+  loop->held = (u64_map){0};
+  loop->held_buttons = 0;
   atomic_init(&loop->status, STATUS_OK);
+  atomic_init(&loop->next_ticket, 1);
+  atomic_init(&loop->ring_inflight, 0);
+  atomic_init(&loop->timer_fired, 0);
+  atomic_init(&loop->timer_late_ns, 0);
+  atomic_init(&loop->timer_max_late_ns, 0);
+  atomic_init(&loop->timer_skipped, 0);
+  loop->keymap_capacity = keymap_capacity;
+  loop->type_burst = type_burst;
+  loop->keymap_cache = keymap_cache;
+  atomic_init(&loop->keymap_uploads, 0);
+  atomic_init(&loop->keymap_upload_bytes, 0);
+  atomic_init(&loop->keymap_last_upload_bytes, 0);
+  atomic_init(&loop->keymap_evictions, 0);
 
   sem_init(&loop->ready_sem, 0, 0);
 
   if (pthread_mutex_init(&loop->pending_mutex, NULL) != 0) {
-    destroy_queue(loop->queue);
-    free(loop->kbd_layout);
     sem_destroy(&loop->ready_sem);
-    free(loop);
+    free_loop(loop);
     return NULL;
   }
 
   if (pthread_create(&loop->thread, NULL, event_loop, loop) != 0) {
     pthread_mutex_destroy(&loop->pending_mutex);
-    destroy_queue(loop->queue);
-    free(loop->kbd_layout);
     sem_destroy(&loop->ready_sem);
-    free(loop);
+    free_loop(loop);
     return NULL;
   }
   sem_wait(&loop->ready_sem);
@@ -168,18 +359,57 @@ void destroy_event_loop(waymo_event_loop *loop) {
   // Wait for the thread to finish processing
   pthread_join(loop->thread, NULL);
 
-  if (loop->queue != NULL)
-    destroy_queue(loop->queue);
-
   if (loop->timer_fd >= 0)
     close(loop->timer_fd);
 
   pthread_mutex_destroy(&loop->pending_mutex);
-
-  free(loop->kbd_layout);
-  free(loop);
+  free_loop(loop);
 }
 
 loop_status get_event_loop_status(waymo_event_loop *loop) {
   return loop->status;
 }
+
+void get_event_loop_stats(waymo_event_loop *loop, eloop_stats *stats) {
+  if (!loop || !stats)
+    return;
+
+  *stats = (eloop_stats){
+      .commands_submitted =
+          atomic_load_explicit(&loop->queue->back, memory_order_relaxed),
+      .queue_wakeups =
+          atomic_load_explicit(&loop->queue->wakeups, memory_order_relaxed),
+      .timer_fired =
+          atomic_load_explicit(&loop->timer_fired, memory_order_relaxed),
+      .timer_late_ns =
+          atomic_load_explicit(&loop->timer_late_ns, memory_order_relaxed),
+      .timer_max_late_ns =
+          atomic_load_explicit(&loop->timer_max_late_ns, memory_order_relaxed),
+      .timer_skipped =
+          atomic_load_explicit(&loop->timer_skipped, memory_order_relaxed),
+      .keymap_uploads =
+          atomic_load_explicit(&loop->keymap_uploads, memory_order_relaxed),
+      .keymap_upload_bytes = atomic_load_explicit(&loop->keymap_upload_bytes,
+                                                  memory_order_relaxed),
+      .keymap_last_upload_bytes = atomic_load_explicit(
+          &loop->keymap_last_upload_bytes, memory_order_relaxed),
+      .keymap_evictions =
+          atomic_load_explicit(&loop->keymap_evictions, memory_order_relaxed),
+  };
+  if (loop->cmd_pool) {
+    stats->command_pool_high_water = pool_high_water(loop->cmd_pool);
+    stats->pool_misses +=
+        atomic_load_explicit(&loop->cmd_pool->misses, memory_order_relaxed);
+  }
+  if (loop->pending_pool) {
+    stats->pending_pool_high_water = pool_high_water(loop->pending_pool);
+    stats->pool_misses += atomic_load_explicit(&loop->pending_pool->misses,
+                                               memory_order_relaxed);
+  }
+  if (loop->sq) {
+    stats->ring_submitted =
+        atomic_load_explicit(&loop->sq->back, memory_order_relaxed);
+    stats->ring_wakeups =
+        atomic_load_explicit(&loop->sq->wakeups, memory_order_relaxed);
+  }
+}
@@ -0,0 +1,84 @@
+#include "events/u64_map.h"
+#include "utils.h"
+#include <stdlib.h>
+
+static size_t map_slot(uint64_t key, size_t cap) {
+  // Fibonacci hashing spreads runs of neighbouring keys
+  return (size_t)((key * UINT64_C(11400714819323198485)) >> 32) & (cap - 1);
+}
+
+// Index of the slot holding key, or of the empty slot ending its run
+static size_t map_find(const u64_map *m, uint64_t key) {
+  size_t mask = m->cap - 1;
+  size_t i = map_slot(key, m->cap);
+  while (m->slots[i].key != U64_MAP_EMPTY && m->slots[i].key != key)
+    i = (i + 1) & mask;
+  return i;
+}
+
+struct u64_entry *u64_map_get(const u64_map *m, uint64_t key) {
+  if (!m->cap || key == U64_MAP_EMPTY)
+    return NULL;
+  struct u64_entry *e = &m->slots[map_find(m, key)];
+  return e->key == key ? e : NULL;
+}
+
+static bool map_grow(u64_map *m) {
+  size_t cap = m->cap ? m->cap * 2 : 16;
+  struct u64_entry *slots = malloc(cap * sizeof(struct u64_entry));
+  if (!slots)
+    return false;
+  for (size_t i = 0; i < cap; i++)
+    slots[i].key = U64_MAP_EMPTY;
+
+  u64_map grown = {.slots = slots, .cap = cap, .len = m->len};
+  for (size_t i = 0; i < m->cap; i++)
+    if (m->slots[i].key != U64_MAP_EMPTY)
+      slots[map_find(&grown, m->slots[i].key)] = m->slots[i];
+  free(m->slots);
+  *m = grown;
+  return true;
+}
+
+struct u64_entry *u64_map_put(u64_map *m, uint64_t key) {
+  if (key == U64_MAP_EMPTY)
+    return NULL;
+  struct u64_entry *e = u64_map_get(m, key);
+  if (e)
+    return e;
+  if (unlikely((m->len + 1) * 2 > m->cap) && !map_grow(m))
+    return NULL;
+
+  e = &m->slots[map_find(m, key)];
+  *e = (struct u64_entry){.key = key};
+  m->len++;
+  return e;
+}
+
+bool u64_map_take(u64_map *m, uint64_t key, struct u64_entry *out) {
+  struct u64_entry *e = u64_map_get(m, key);
+  if (!e)
+    return false;
+  if (out)
+    *out = *e;
+
+  // Shift later entries of the run back so no probe stops at the gap early
+  size_t mask = m->cap - 1;
+  size_t i = (size_t)(e - m->slots);
+  for (size_t j = (i + 1) & mask; m->slots[j].key != U64_MAP_EMPTY;
+       j = (j + 1) & mask) {
+    size_t home = map_slot(m->slots[j].key, m->cap);
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      m->slots[i] = m->slots[j];
+      i = j;
+    }
+  }
+  m->slots[i].key = U64_MAP_EMPTY;
+  m->len--;
+  return true;
+}
+
+void u64_map_clear(u64_map *m) {
+  free(m->slots);
+  *m = (u64_map){0};
+}
@@ -1,194 +1,438 @@
 #include "events/pendings.h"
+#include "events/pool.h"
 #include "utils.h"
 #include <pthread.h>
 #include <stdlib.h>
 #include <sys/timerfd.h>
 #include <unistd.h>
 
+struct pending_action *alloc_pending(waymo_event_loop *loop) {
+  struct pending_action *act =
+      loop->pending_pool ? pool_get(loop->pending_pool) : NULL;
+  if (unlikely(!act))
+    act = malloc(sizeof(struct pending_action));
+  if (act)
+    act->ticket = 0;
+  return act;
+}
+
+void free_pending(waymo_event_loop *loop, struct pending_action *act) {
+  // A batch may have moved its ticket on to the action of a later step
+  struct u64_entry *e =
+      act->ticket ? u64_map_get(&loop->tickets, act->ticket) : NULL;
+  if (e && e->ptr == act)
+    u64_map_take(&loop->tickets, act->ticket, NULL);
+  if (pool_owns(loop->pending_pool, act))
+    pool_put(loop->pending_pool, act);
+  else
+    free(act);
+}
+
 void update_timer(waymo_event_loop *loop) {
-  if (!loop->pending_head)
+  struct pending_action *next = peek_pending(loop);
+  uint64_t deadline = next ? next->expiry_ns : UINT64_MAX;
+  // Held back commands also need a wakeup once the cooldown is over
+  if (loop->intake_deferred && loop->cooldown_until_ns < deadline)
+    deadline = loop->cooldown_until_ns;
+  if (deadline == UINT64_MAX)
     return;
 
-  uint64_t now = timestamp();
-  uint64_t diff = (loop->pending_head->expiry_ms > now)
-                      ? (loop->pending_head->expiry_ms - now)
-                      : 1;
-
+  // An absolute deadline does not drift by however long it took to get here.
+  // Deadlines already in the past fire straight away, but zero would disarm
+  if (deadline == 0)
+    deadline = 1;
   struct itimerspec new_val = {
-      .it_value = {.tv_sec = diff / 1000, .tv_nsec = (diff % 1000) * 1000000}};
-  timerfd_settime(loop->timer_fd, 0, &new_val, NULL);
+      .it_value = {.tv_sec = deadline / 1000000000,
+                   .tv_nsec = deadline % 1000000000}};
+  timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &new_val, NULL);
+}
+
+// Actions due at the same time keep the order they were scheduled in, as they
+// did when this was a sorted list
+static bool pending_before(const struct pending_action *a,
+                           const struct pending_action *b) {
+  if (a->expiry_ns != b->expiry_ns)
+    return a->expiry_ns < b->expiry_ns;
+  return a->seq < b->seq;
+}
+
+static void heap_set(waymo_event_loop *loop, size_t i,
+                     struct pending_action *act) {
+  loop->pending[i] = act;
+  act->heap_index = i;
 }
 
-inline void schedule_action_locked(waymo_event_loop *loop,
-                                   struct pending_action *action) {
-  struct pending_action **curr = &loop->pending_head;
-  while (*curr && (*curr)->expiry_ms < action->expiry_ms) {
-    curr = &((*curr)->next);
+static void sift_up(waymo_event_loop *loop, size_t i) {
+  struct pending_action *act = loop->pending[i];
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (!pending_before(act, loop->pending[parent]))
+      break;
+    heap_set(loop, i, loop->pending[parent]);
+    i = parent;
   }
-  action->next = *curr;
-  *curr = action;
-  update_timer(loop);
+  heap_set(loop, i, act);
 }
 
-void schedule_action(waymo_event_loop *loop, struct pending_action *action) {
+static void sift_down(waymo_event_loop *loop, size_t i) {
+  struct pending_action *act = loop->pending[i];
+  while (true) {
+    size_t child = i * 2 + 1;
+    if (child >= loop->pending_len)
+      break;
+    if (child + 1 < loop->pending_len &&
+        pending_before(loop->pending[child + 1], loop->pending[child]))
+      child++;
+    if (!pending_before(loop->pending[child], act))
+      break;
+    heap_set(loop, i, loop->pending[child]);
+    i = child;
+  }
+  heap_set(loop, i, act);
+}
+
+bool schedule_action_locked(waymo_event_loop *loop,
+                            struct pending_action *action) {
+  if (loop->pending_len == loop->pending_cap) {
+    size_t cap = loop->pending_cap ? loop->pending_cap * 2 : 64;
+    struct pending_action **heap =
+        realloc(loop->pending, cap * sizeof(struct pending_action *));
+    if (!heap)
+      return false;
+    loop->pending = heap;
+    loop->pending_cap = cap;
+  }
+
+  action->seq = loop->pending_seq++;
+  action->ticket = completion_ticket(action->done);
+  // Without memory the action just cannot be cancelled alone. Periodic ones
+  // are put again on every tick and find their own entry
+  struct u64_entry *e =
+      action->ticket ? u64_map_put(&loop->tickets, action->ticket) : NULL;
+  if (e)
+    e->ptr = action;
+  heap_set(loop, loop->pending_len++, action);
+  sift_up(loop, action->heap_index);
+  // The timer only moves when this became the earliest action
+  if (action->heap_index == 0)
+    update_timer(loop);
+  return true;
+}
+
+bool schedule_action(waymo_event_loop *loop, struct pending_action *action) {
   pthread_mutex_lock(&loop->pending_mutex);
-  schedule_action_locked(loop, action);
+  bool ok = schedule_action_locked(loop, action);
   pthread_mutex_unlock(&loop->pending_mutex);
+  return ok;
+}
+
+struct pending_action *pop_pending_locked(waymo_event_loop *loop) {
+  if (!loop->pending_len)
+    return NULL;
+
+  struct pending_action *top = loop->pending[0];
+  struct pending_action *last = loop->pending[--loop->pending_len];
+  if (loop->pending_len) {
+    heap_set(loop, 0, last);
+    sift_down(loop, 0);
+  }
+  return top;
+}
+
+void remove_pending_locked(waymo_event_loop *loop,
+                           struct pending_action *act) {
+  size_t i = act->heap_index;
+  struct pending_action *last = loop->pending[--loop->pending_len];
+  if (i == loop->pending_len)
+    return;
+
+  heap_set(loop, i, last);
+  if (i > 0 && pending_before(last, loop->pending[(i - 1) / 2]))
+    sift_up(loop, i);
+  else
+    sift_down(loop, i);
 }
 
 void clear_pending_actions(waymo_event_loop *loop) {
   pthread_mutex_lock(&loop->pending_mutex);
-  struct pending_action *curr = loop->pending_head;
-  while (curr) {
-    struct pending_action *next = curr->next;
-    if (curr->type == ACTION_TYPE_STEP && curr->data.type_txt.txt) {
-      free(curr->data.type_txt.txt);
+  for (size_t i = 0; i < loop->pending_len; i++) {
+    struct pending_action *curr = loop->pending[i];
+    if (curr->type == ACTION_TYPE_STEP && curr->data.type_txt.codes) {
+      free(curr->data.type_txt.codes);
     }
-    free(curr);
-    curr = next;
+    release_completion(curr->done);
+    free_pending(loop, curr);
   }
-  loop->pending_head = NULL;
+  free(loop->pending);
+  loop->pending = NULL;
+  loop->pending_len = 0;
+  loop->pending_cap = 0;
+  u64_map_clear(&loop->tickets);
   pthread_mutex_unlock(&loop->pending_mutex);
 }
 
+// Undoes whatever a stopped action left half done, then frees it
+static void abort_action(waymo_event_loop *loop, waymoctx *ctx,
+                         struct pending_action *act) {
+  switch (act->type) {
+  case ACTION_KEY_RELEASE:
+    waymoctx_key(ctx, act->data.key.keycode, WL_KEYBOARD_KEY_STATE_RELEASED);
+    break;
+  case ACTION_MOUSE_RELEASE:
+    waymoctx_ptr_button(ctx, act->data.mouse.button,
+                        WL_POINTER_BUTTON_STATE_RELEASED);
+    break;
+  case ACTION_CLICK_STEP:
+    if (act->data.click.is_down)
+      waymoctx_ptr_button(ctx, act->data.click.button,
+                          WL_POINTER_BUTTON_STATE_RELEASED);
+    break;
+  case ACTION_TYPE_STEP:
+    waymoctx_unpin_keys(ctx, act->data.type_txt.codes, act->data.type_txt.len);
+    free(act->data.type_txt.codes);
+    act->data.type_txt.codes = NULL;
+    break;
+  case ACTION_KEY_REPEAT:
+    waymoctx_unpin_keys(ctx, &act->data.key_repeat.keycode, 1);
+    break;
+  case ACTION_KEY_HOLD:
+    // Owned by its held key, which is released before anything gets here
+    break;
+  }
+  completion done = act->done;
+  free_pending(loop, act);
+  signal_completion(loop, ctx, release_completion(done), RESULT_CANCELLED);
+}
+
+bool cancel_actions(waymo_event_loop *loop, waymoctx *ctx,
+                    action_ticket ticket) {
+  if (ticket) {
+    pthread_mutex_lock(&loop->pending_mutex);
+    struct u64_entry *e = u64_map_get(&loop->tickets, ticket);
+    struct pending_action *act = e ? e->ptr : NULL;
+    if (act) {
+      remove_pending_locked(loop, act);
+      update_timer(loop);
+    }
+    pthread_mutex_unlock(&loop->pending_mutex);
+    if (!act)
+      return cancel_held_batches(loop, ctx, ticket);
+    abort_action(loop, ctx, act);
+    return true;
+  }
+
+  // Held keys take their repeats out of the heap, the rest goes in one swap
+  waymoctx_drop_staged_presses(ctx);
+  release_held_keys(loop, ctx);
+  release_held_buttons(loop, ctx);
+  pthread_mutex_lock(&loop->pending_mutex);
+  struct pending_action **acts = loop->pending;
+  size_t len = loop->pending_len;
+  loop->pending = NULL;
+  loop->pending_len = 0;
+  loop->pending_cap = 0;
+  update_timer(loop);
+  pthread_mutex_unlock(&loop->pending_mutex);
+  for (size_t i = 0; i < len; i++)
+    abort_action(loop, ctx, acts[i]);
+  free(acts);
+  cancel_held_batches(loop, ctx, 0);
+  return true;
+}
+
+void release_held_key(waymo_event_loop *loop, waymoctx *ctx, uint32_t key) {
+  struct u64_entry held;
+  if (u64_map_take(&loop->held, KEY_CODE(key), &held)) {
+    struct pending_action *repeat = held.ptr;
+    if (repeat) {
+      pthread_mutex_lock(&loop->pending_mutex);
+      remove_pending_locked(loop, repeat);
+      pthread_mutex_unlock(&loop->pending_mutex);
+      free_pending(loop, repeat);
+    }
+    waymoctx_unpin_keys(ctx, &held.u32, 1);
+    key = held.u32;
+  }
+  waymoctx_key(ctx, key, WL_KEYBOARD_KEY_STATE_RELEASED);
+}
+
+void release_held_keys(waymo_event_loop *loop, waymoctx *ctx) {
+  while (loop->held.len) {
+    size_t i = 0;
+    while (loop->held.slots[i].key == U64_MAP_EMPTY)
+      i++;
+    release_held_key(loop, ctx, loop->held.slots[i].u32);
+  }
+  u64_map_clear(&loop->held);
+}
+
+void release_held_buttons(waymo_event_loop *loop, waymoctx *ctx) {
+  for (uint32_t i = 0; loop->held_buttons; i++) {
+    if (!(loop->held_buttons & (1u << i)))
+      continue;
+    if (ctx->ptr)
+      waymoctx_ptr_button(ctx, BTN_MOUSE + i, WL_POINTER_BUTTON_STATE_RELEASED);
+    loop->held_buttons &= ~(1u << i);
+  }
+}
+
+// A completion can resume a batch which schedules more actions, so it has to
+// run without the pending lock held
+static void complete_unlocked(waymo_event_loop *loop, waymoctx *ctx,
+                              completion done, action_result result) {
+  pthread_mutex_unlock(&loop->pending_mutex);
+  signal_completion(loop, ctx, done, result);
+  pthread_mutex_lock(&loop->pending_mutex);
+}
+
+// Only the loop thread writes these so plain loads and stores are enough
+static void record_lateness(waymo_event_loop *loop, uint64_t late_ns) {
+  atomic_store_explicit(
+      &loop->timer_fired,
+      atomic_load_explicit(&loop->timer_fired, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+  atomic_store_explicit(
+      &loop->timer_late_ns,
+      atomic_load_explicit(&loop->timer_late_ns, memory_order_relaxed) +
+          late_ns,
+      memory_order_relaxed);
+  if (late_ns >
+      atomic_load_explicit(&loop->timer_max_late_ns, memory_order_relaxed))
+    atomic_store_explicit(&loop->timer_max_late_ns, late_ns,
+                          memory_order_relaxed);
+}
+
+// Moves a periodic action to its next tick. A deadline that has already passed
+// means the loop is a whole interval behind, which the action's policy decides
+// how to handle
+static void next_tick(waymo_event_loop *loop, struct pending_action *act,
+                      uint64_t interval_ns, uint64_t now) {
+  act->tick++;
+  act->expiry_ns = act->start_ns + act->tick * interval_ns;
+  if (act->late != LATE_SKIP || act->expiry_ns > now || interval_ns == 0)
+    return;
+
+  uint64_t missed = (now - act->expiry_ns) / interval_ns + 1;
+  act->tick += missed;
+  act->expiry_ns += missed * interval_ns;
+  atomic_store_explicit(
+      &loop->timer_skipped,
+      atomic_load_explicit(&loop->timer_skipped, memory_order_relaxed) +
+          missed,
+      memory_order_relaxed);
+}
+
 void handle_timer_expiry(waymo_event_loop *loop, waymoctx *ctx) {
   pthread_mutex_lock(&loop->pending_mutex);
-  uint64_t now = timestamp();
+  uint64_t now = timestamp_ns();
 
-  while (loop->pending_head && loop->pending_head->expiry_ms <= now) {
-    struct pending_action *act = loop->pending_head;
-    loop->pending_head = act->next;
-    // Schedule next repeat if we haven't reached total hold time
+  while (loop->pending_len && loop->pending[0]->expiry_ns <= now) {
+    struct pending_action *act = pop_pending_locked(loop);
+    record_lateness(loop, now - act->expiry_ns);
+    // Steps that continue reschedule act itself rather than a copy of it. The
+    // pop just made room for it so that can never fail
+    bool requeued = false;
 
     switch (act->type) {
     case ACTION_KEY_RELEASE: {
-      zwp_virtual_keyboard_v1_key(ctx->kbd, timestamp(), act->data.key.keycode,
-                                  WL_KEYBOARD_KEY_STATE_RELEASED);
-
-      wl_display_flush(ctx->display);
-      signal_done(act->done_fd, loop->action_cooldown_ms);
+      waymoctx_key(ctx, act->data.key.keycode, WL_KEYBOARD_KEY_STATE_RELEASED);
+      complete_unlocked(loop, ctx, act->done, RESULT_DONE);
       break;
     }
     case ACTION_MOUSE_RELEASE: {
-      zwlr_virtual_pointer_v1_button(ctx->ptr, timestamp(),
-                                     act->data.mouse.button,
-                                     WL_POINTER_BUTTON_STATE_RELEASED);
-      zwlr_virtual_pointer_v1_frame(ctx->ptr);
-      wl_display_flush(ctx->display);
-      signal_done(act->done_fd, loop->action_cooldown_ms);
+      waymoctx_ptr_button(ctx, act->data.mouse.button,
+                          WL_POINTER_BUTTON_STATE_RELEASED);
+      complete_unlocked(loop, ctx, act->done, RESULT_DONE);
       break;
     }
     case ACTION_CLICK_STEP: {
       uint32_t state = act->data.click.is_down
                            ? WL_POINTER_BUTTON_STATE_RELEASED
                            : WL_POINTER_BUTTON_STATE_PRESSED;
-      zwlr_virtual_pointer_v1_button(ctx->ptr, timestamp(),
-                                     act->data.click.button, state);
-      zwlr_virtual_pointer_v1_frame(ctx->ptr);
-      wl_display_flush(ctx->display);
-
-      if (act->data.click.is_down || act->data.click.remaining > 1) {
-        struct pending_action *next_step =
-            malloc(sizeof(struct pending_action));
-        if (next_step) {
-          *next_step = *act;
-          next_step->expiry_ms = now + act->data.click.ms;
-          next_step->data.click.is_down = !act->data.click.is_down;
-          if (!next_step->data.click.is_down)
-            next_step->data.click.remaining--;
-          schedule_action_locked(loop, next_step);
-        }
+      waymoctx_ptr_button(ctx, act->data.click.button, state);
+
+      // A release finishes one click, a press always needs its release
+      if (!act->data.click.is_down || act->data.click.remaining > 1) {
+        next_tick(loop, act, act->data.click.ns, now);
+        act->data.click.is_down = !act->data.click.is_down;
+        if (!act->data.click.is_down)
+          act->data.click.remaining--;
+        schedule_action_locked(loop, act);
+        requeued = true;
       } else {
-        signal_done(act->done_fd, loop->action_cooldown_ms);
+        complete_unlocked(loop, ctx, act->done, RESULT_DONE);
       }
       break;
     }
     case ACTION_TYPE_STEP: {
-      char c = act->data.type_txt.txt[act->data.type_txt.index];
-      if (c != '\0') {
-        wchar_t wc;
-        mbtowc(&wc, &c, 1);
-
-        uint32_t keycode = waymoctx_get_keycode(ctx, wc);
-
-        zwp_virtual_keyboard_v1_key(ctx->kbd, timestamp(), keycode,
-                                    WL_KEYBOARD_KEY_STATE_PRESSED);
-        zwp_virtual_keyboard_v1_key(ctx->kbd, timestamp(), keycode,
-                                    WL_KEYBOARD_KEY_STATE_RELEASED);
-        wl_display_flush(ctx->display);
-
-        if (act->data.type_txt.txt[act->data.type_txt.index + 1] != '\0') {
-          struct pending_action *next_char =
-              malloc(sizeof(struct pending_action));
-          if (next_char) {
-            *next_char = *act;
-            next_char->data.type_txt.index++;
-            next_char->expiry_ms = now + act->data.type_txt.interval_ms;
-            schedule_action_locked(loop, next_char);
-            act->data.type_txt.txt = NULL;
-            break;
-          } else
-            goto text_free;
-        } else
-          goto text_free;
-      } else
-        goto text_free;
-    text_free:
-      free(act->data.type_txt.txt);
-      act->data.type_txt.txt = NULL;
-      signal_done(act->done_fd, loop->action_cooldown_ms);
+      // Without an interval a whole burst goes out per expiry, each one
+      // flushed at the end of its tick before the next is written
+      uint64_t interval_ns = act->data.type_txt.interval_ns;
+      size_t burst = interval_ns || !loop->type_burst ? 1 : loop->type_burst;
+      size_t end = act->data.type_txt.index + burst;
+      if (end > act->data.type_txt.len)
+        end = act->data.type_txt.len;
+      for (size_t i = act->data.type_txt.index; i < end; i++) {
+        uint32_t keycode = act->data.type_txt.codes[i];
+        waymoctx_key(ctx, keycode, WL_KEYBOARD_KEY_STATE_PRESSED);
+        waymoctx_key(ctx, keycode, WL_KEYBOARD_KEY_STATE_RELEASED);
+      }
+      act->data.type_txt.index = end;
+
+      if (end < act->data.type_txt.len) {
+        // A burst is due again right away but only on the next tick
+        if (interval_ns)
+          next_tick(loop, act, interval_ns, now);
+        else
+          act->expiry_ns = now + 1;
+        schedule_action_locked(loop, act);
+        requeued = true;
+        break;
+      }
+      waymoctx_unpin_keys(ctx, act->data.type_txt.codes,
+                          act->data.type_txt.len);
+      free(act->data.type_txt.codes);
+      act->data.type_txt.codes = NULL;
+      complete_unlocked(loop, ctx, act->done, RESULT_DONE);
       break;
     }
     case ACTION_KEY_REPEAT: {
       // Send key press and release for this repeat
-      zwp_virtual_keyboard_v1_key(ctx->kbd, timestamp(),
-                                  act->data.key_repeat.keycode,
-                                  WL_KEYBOARD_KEY_STATE_PRESSED);
-      zwp_virtual_keyboard_v1_key(ctx->kbd, timestamp(),
-                                  act->data.key_repeat.keycode,
-                                  WL_KEYBOARD_KEY_STATE_RELEASED);
-      wl_display_flush(ctx->display);
-
-      // Schedule next if not reached required time
-      act->data.key_repeat.elapsed_ms +=
-          act->data.key_repeat.repeat_interval_ms;
-
-      if (act->data.key_repeat.elapsed_ms <
-          act->data.key_repeat.total_hold_ms) {
-        struct pending_action *next_repeat =
-            malloc(sizeof(struct pending_action));
-        if (next_repeat) {
-          *next_repeat = *act;
-          next_repeat->expiry_ms =
-              now + act->data.key_repeat.repeat_interval_ms;
-          schedule_action_locked(loop, next_repeat);
-        }
+      waymoctx_key(ctx, act->data.key_repeat.keycode,
+                   WL_KEYBOARD_KEY_STATE_PRESSED);
+      waymoctx_key(ctx, act->data.key_repeat.keycode,
+                   WL_KEYBOARD_KEY_STATE_RELEASED);
+
+      // Schedule next if not reached required time, skipped ticks still count
+      // towards it so the hold ends on time
+      next_tick(loop, act, act->data.key_repeat.repeat_interval_ns, now);
+      if (act->tick * act->data.key_repeat.repeat_interval_ns <
+          act->data.key_repeat.total_hold_ns) {
+        schedule_action_locked(loop, act);
+        requeued = true;
       } else {
         // Held for required time
-        signal_done(act->done_fd, loop->action_cooldown_ms);
+        waymoctx_unpin_keys(ctx, &act->data.key_repeat.keycode, 1);
+        complete_unlocked(loop, ctx, act->done, RESULT_DONE);
       }
       break;
     }
     case ACTION_KEY_HOLD: {
-      zwp_virtual_keyboard_v1_key(ctx->kbd, timestamp(),
-                                  act->data.key_hold.keycode,
-                                  WL_KEYBOARD_KEY_STATE_PRESSED);
-      zwp_virtual_keyboard_v1_key(ctx->kbd, timestamp(),
-                                  act->data.key_hold.keycode,
-                                  WL_KEYBOARD_KEY_STATE_RELEASED);
-      wl_display_flush(ctx->display);
-
-      struct pending_action *next_hold = malloc(sizeof(struct pending_action));
-      if (next_hold) {
-        *next_hold = *act;
-        next_hold->expiry_ms = now + act->data.key_hold.interval_ms;
-        schedule_action_locked(loop, next_hold);
-      }
+      // The key is down between repeats, each one presses it afresh
+      waymoctx_key(ctx, act->data.key_hold.keycode,
+                   WL_KEYBOARD_KEY_STATE_RELEASED);
+      waymoctx_key(ctx, act->data.key_hold.keycode,
+                   WL_KEYBOARD_KEY_STATE_PRESSED);
+
+      next_tick(loop, act, act->data.key_hold.interval_ns, now);
+      schedule_action_locked(loop, act);
+      requeued = true;
       break;
     }
     }
-    wl_display_flush(ctx->display);
-    free(act);
+    // Requests sent above go out with the one flush at the end of the tick
+    if (!requeued)
+      free_pending(loop, act);
   }
   update_timer(loop);
   pthread_mutex_unlock(&loop->pending_mutex);
@@ -0,0 +1,89 @@
+#include "events/pool.h"
+#include <stdlib.h>
+
+#define HEAD(tag, idx) (((uint64_t)(tag) << 32) | (uint32_t)(idx))
+#define HEAD_TAG(head) ((uint32_t)((head) >> 32))
+#define HEAD_IDX(head) ((uint32_t)(head))
+
+object_pool *create_pool(unsigned int capacity, size_t obj_size) {
+  if (capacity == 0)
+    return NULL;
+
+  object_pool *p = aligned_alloc(WAYMO_CACHELINE, sizeof(object_pool));
+  if (!p)
+    return NULL;
+
+  // Keep every object on its own cache lines like the rings do
+  p->stride = (obj_size + WAYMO_CACHELINE - 1) / WAYMO_CACHELINE *
+              WAYMO_CACHELINE;
+  p->objs = aligned_alloc(WAYMO_CACHELINE, p->stride * capacity);
+  p->next = malloc(sizeof(*p->next) * capacity);
+  if (!p->objs || !p->next) {
+    free(p->objs);
+    free(p->next);
+    free(p);
+    return NULL;
+  }
+
+  p->capacity = capacity;
+  for (unsigned int i = 0; i < capacity; i++)
+    atomic_init(&p->next[i], 0);
+  atomic_init(&p->misses, 0);
+  atomic_init(&p->carved, 0);
+  atomic_init(&p->head, HEAD(0, 0));
+  return p;
+}
+
+void destroy_pool(object_pool *p) {
+  if (!p)
+    return;
+  free(p->next);
+  free(p->objs);
+  free(p);
+}
+
+void *pool_get(object_pool *p) {
+  uint64_t head = atomic_load_explicit(&p->head, memory_order_acquire);
+  while (HEAD_IDX(head) != 0) {
+    uint32_t idx = HEAD_IDX(head) - 1;
+    uint32_t next = atomic_load_explicit(&p->next[idx], memory_order_relaxed);
+    if (atomic_compare_exchange_weak_explicit(
+            &p->head, &head, HEAD(HEAD_TAG(head) + 1, next),
+            memory_order_acquire, memory_order_acquire))
+      return p->objs + (size_t)idx * p->stride;
+  }
+
+  // Nothing returned yet, hand out a slot that has never been used
+  unsigned int carved =
+      atomic_load_explicit(&p->carved, memory_order_relaxed);
+  while (carved < p->capacity) {
+    if (atomic_compare_exchange_weak_explicit(&p->carved, &carved, carved + 1,
+                                              memory_order_relaxed,
+                                              memory_order_relaxed))
+      return p->objs + (size_t)carved * p->stride;
+  }
+
+  atomic_fetch_add_explicit(&p->misses, 1, memory_order_relaxed);
+  return NULL;
+}
+
+void pool_put(object_pool *p, void *obj) {
+  uint32_t idx = (uint32_t)(((unsigned char *)obj - p->objs) / p->stride);
+  uint64_t head = atomic_load_explicit(&p->head, memory_order_relaxed);
+  do {
+    atomic_store_explicit(&p->next[idx], HEAD_IDX(head), memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak_explicit(
+      &p->head, &head, HEAD(HEAD_TAG(head) + 1, idx + 1), memory_order_release,
+      memory_order_relaxed));
+}
+
+bool pool_owns(const object_pool *p, const void *obj) {
+  if (!p)
+    return false;
+  const unsigned char *o = obj;
+  return o >= p->objs && o < p->objs + p->stride * p->capacity;
+}
+
+unsigned int pool_high_water(object_pool *p) {
+  return atomic_load_explicit(&p->carved, memory_order_relaxed);
+}
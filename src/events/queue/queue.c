@@ -1,23 +1,35 @@
 #include "events/queue.h"
-#include <pthread.h>
+#include "utils.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
 
 command_queue *create_queue(unsigned int max_commands) {
-  command_queue *q = malloc(sizeof(command_queue));
+  command_queue *q = aligned_alloc(WAYMO_CACHELINE, sizeof(command_queue));
   if (!q)
     return NULL;
 
-  q->commands = calloc(max_commands, sizeof(command *));
+  q->slots = calloc(max_commands ? max_commands : 1, sizeof(queue_slot));
   q->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (!q->slots || q->fd < 0) {
+    if (q->fd >= 0)
+      close(q->fd);
+    free(q->slots);
+    free(q);
+    return NULL;
+  }
 
-  pthread_mutex_init(&q->mutex, NULL);
-  q->num_commands = 0;
+  for (unsigned int i = 0; i < max_commands; i++) {
+    atomic_init(&q->slots[i].seq, i);
+    q->slots[i].cmd = NULL;
+  }
   q->max_capacity = max_commands;
-  q->front = 0;
-  q->back = 0;
-  q->shutdown = false;
+  atomic_init(&q->back, 0);
+  atomic_init(&q->front, 0);
+  atomic_init(&q->shutdown, false);
+  atomic_init(&q->signalled, false);
+  atomic_init(&q->wakeups, 0);
   return q;
 }
 
@@ -25,66 +37,137 @@ void destroy_queue(command_queue *q) {
   if (!q)
     return;
 
-  pthread_mutex_lock(&q->mutex);
   atomic_store(&q->shutdown, true);
 
-  while (q->num_commands > 0) {
-    command *cmd = q->commands[q->front];
-    if (cmd) {
-      free_command(cmd);
-    }
-    q->commands[q->front] = NULL;
-    q->front = (q->front + 1) % q->max_capacity;
-    q->num_commands--;
+  command *cmd;
+  while ((cmd = remove_queue(q))) {
+    free_command(cmd);
   }
-  pthread_mutex_unlock(&q->mutex);
-
-  pthread_mutex_destroy(&q->mutex);
 
   if (q->fd >= 0) {
     close(q->fd);
     q->fd = -1;
   }
 
-  free(q->commands);
+  free(q->slots);
   free(q);
 }
 
 bool add_queue(command_queue *q, command *cmd) {
-  pthread_mutex_lock(&q->mutex);
-  if (q->num_commands >= q->max_capacity || atomic_load(&q->shutdown)) {
-    pthread_mutex_unlock(&q->mutex);
+  if (unlikely(q->max_capacity == 0) ||
+      atomic_load_explicit(&q->shutdown, memory_order_acquire))
     return false;
+
+  size_t pos = atomic_load_explicit(&q->back, memory_order_relaxed);
+  queue_slot *slot;
+  while (true) {
+    slot = &q->slots[pos % q->max_capacity];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+    if (dif == 0) {
+      // Slot is free, try to claim this position
+      if (atomic_compare_exchange_weak_explicit(&q->back, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      // The consumer has not released this slot yet so the ring is full
+      return false;
+    } else {
+      pos = atomic_load_explicit(&q->back, memory_order_relaxed);
+    }
   }
 
-  q->commands[q->back] = cmd;
-  unsigned int new_back = (q->back + 1) % q->max_capacity;
+  slot->cmd = cmd;
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
 
-  // Signal the epoll loop
-  uint64_t u = 1;
-  if (write(q->fd, &u, sizeof(uint64_t)) == -1) {
-    // Rollback on write failure
-    q->commands[q->back] = NULL;
-    pthread_mutex_unlock(&q->mutex);
-    return false;
-  }
+  // Pairs with the fence in ack_queue: either the loop sees this command while
+  // draining or we see that it has re-armed and must be woken again
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&q->signalled, memory_order_relaxed) ||
+      atomic_exchange(&q->signalled, true))
+    return true;
 
-  q->back = new_back;
-  q->num_commands++;
-  pthread_mutex_unlock(&q->mutex);
+  // Signal the epoll loop. The command is already visible so there is nothing
+  // to roll back; a failed write can only mean the counter is saturated which
+  // still leaves the fd readable
+  uint64_t u = 1;
+  while (write(q->fd, &u, sizeof(uint64_t)) == -1 && errno == EINTR)
+    ;
+  atomic_fetch_add_explicit(&q->wakeups, 1, memory_order_relaxed);
   return true;
 }
 
 command *remove_queue(command_queue *q) {
-  pthread_mutex_lock(&q->mutex);
-  if (q->num_commands == 0) {
-    pthread_mutex_unlock(&q->mutex);
+  if (unlikely(q->max_capacity == 0))
     return NULL;
+
+  // Only the event loop consumes in practice so this CAS is uncontended, it
+  // just keeps the ring safe for tests that drain from several threads
+  size_t pos = atomic_load_explicit(&q->front, memory_order_relaxed);
+  queue_slot *slot;
+  while (true) {
+    slot = &q->slots[pos % q->max_capacity];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->front, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      // Nothing published at this position yet
+      return NULL;
+    } else {
+      pos = atomic_load_explicit(&q->front, memory_order_relaxed);
+    }
   }
-  command *cmd = q->commands[q->front];
-  q->commands[q->front] = NULL;
-  q->front = (q->front + 1) % q->max_capacity;
-  q->num_commands--;
-  pthread_mutex_unlock(&q->mutex);
+
+  command *cmd = slot->cmd;
+  slot->cmd = NULL;
+  // Hand the slot back to producers one lap ahead
+  atomic_store_explicit(&slot->seq, pos + q->max_capacity,
+                        memory_order_release);
   return cmd;
 }
+
+command *peek_queue(command_queue *q) {
+  if (unlikely(q->max_capacity == 0))
+    return NULL;
+
+  size_t pos = atomic_load_explicit(&q->front, memory_order_relaxed);
+  queue_slot *slot = &q->slots[pos % q->max_capacity];
+  if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+    return NULL;
+  return slot->cmd;
+}
+
+unsigned int count_queue(command_queue *q) {
+  size_t front = atomic_load_explicit(&q->front, memory_order_acquire);
+  size_t back = atomic_load_explicit(&q->back, memory_order_acquire);
+  return back > front ? (unsigned int)(back - front) : 0;
+}
+
+bool mute_queue(command_queue *q) {
+  uint64_t u;
+  if (read(q->fd, &u, sizeof(uint64_t)) == -1 && errno != EAGAIN &&
+      errno != EINTR)
+    return false;
+  return true;
+}
+
+void hold_queue(command_queue *q) {
+  atomic_store_explicit(&q->signalled, true, memory_order_relaxed);
+}
+
+bool ack_queue(command_queue *q) {
+  uint64_t u;
+  if (read(q->fd, &u, sizeof(uint64_t)) == -1 && errno != EAGAIN &&
+      errno != EINTR)
+    return false;
+
+  // Re-arm before draining so anything published from here on signals again
+  atomic_store_explicit(&q->signalled, false, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  return true;
+}
@@ -0,0 +1,142 @@
+#include "events/ring.h"
+#include "utils.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define SLOT(r, pos) ((r)->slots + ((pos) % (r)->entries) * (r)->stride)
+#define SLOT_SEQ(slot) ((WAYMO_ATOMIC(size_t) *)(slot))
+#define SLOT_DATA(slot) ((slot) + sizeof(WAYMO_ATOMIC(size_t)))
+
+record_ring *create_ring(unsigned int entries, size_t record_size,
+                         bool parkable) {
+  if (entries == 0)
+    return NULL;
+
+  record_ring *r = aligned_alloc(WAYMO_CACHELINE, sizeof(record_ring));
+  if (!r)
+    return NULL;
+
+  size_t stride = sizeof(WAYMO_ATOMIC(size_t)) + record_size;
+  stride = (stride + WAYMO_CACHELINE - 1) / WAYMO_CACHELINE * WAYMO_CACHELINE;
+  r->slots = aligned_alloc(WAYMO_CACHELINE, stride * entries);
+  r->fd = parkable ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1;
+  if (!r->slots || (parkable && r->fd < 0)) {
+    if (r->fd >= 0)
+      close(r->fd);
+    free(r->slots);
+    free(r);
+    return NULL;
+  }
+
+  r->stride = stride;
+  r->record_size = record_size;
+  r->entries = entries;
+  for (unsigned int i = 0; i < entries; i++)
+    atomic_init(SLOT_SEQ(SLOT(r, i)), i);
+  atomic_init(&r->need_wakeup, false);
+  atomic_init(&r->wakeups, 0);
+  atomic_init(&r->back, 0);
+  atomic_init(&r->front, 0);
+  return r;
+}
+
+void destroy_ring(record_ring *r) {
+  if (!r)
+    return;
+  if (r->fd >= 0)
+    close(r->fd);
+  free(r->slots);
+  free(r);
+}
+
+bool push_ring(record_ring *r, const void *record) {
+  size_t pos = atomic_load_explicit(&r->back, memory_order_relaxed);
+  unsigned char *slot;
+  while (true) {
+    slot = SLOT(r, pos);
+    size_t seq = atomic_load_explicit(SLOT_SEQ(slot), memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&r->back, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      return false;
+    } else {
+      pos = atomic_load_explicit(&r->back, memory_order_relaxed);
+    }
+  }
+
+  memcpy(SLOT_DATA(slot), record, r->record_size);
+  atomic_store_explicit(SLOT_SEQ(slot), pos + 1, memory_order_release);
+  return true;
+}
+
+bool pop_ring(record_ring *r, void *record) {
+  size_t pos = atomic_load_explicit(&r->front, memory_order_relaxed);
+  unsigned char *slot;
+  while (true) {
+    slot = SLOT(r, pos);
+    size_t seq = atomic_load_explicit(SLOT_SEQ(slot), memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&r->front, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      return false;
+    } else {
+      pos = atomic_load_explicit(&r->front, memory_order_relaxed);
+    }
+  }
+
+  memcpy(record, SLOT_DATA(slot), r->record_size);
+  atomic_store_explicit(SLOT_SEQ(slot), pos + r->entries, memory_order_release);
+  return true;
+}
+
+unsigned int count_ring(record_ring *r) {
+  size_t front = atomic_load_explicit(&r->front, memory_order_acquire);
+  size_t back = atomic_load_explicit(&r->back, memory_order_acquire);
+  return back > front ? (unsigned int)(back - front) : 0;
+}
+
+void kick_ring(record_ring *r) {
+  // Pairs with the fence in park_ring: either the consumer sees our records
+  // before blocking or we see that it is parked
+  atomic_thread_fence(memory_order_seq_cst);
+  if (likely(!atomic_load_explicit(&r->need_wakeup, memory_order_relaxed)) ||
+      !atomic_exchange(&r->need_wakeup, false))
+    return;
+
+  uint64_t u = 1;
+  while (write(r->fd, &u, sizeof(uint64_t)) == -1 && errno == EINTR)
+    ;
+  atomic_fetch_add_explicit(&r->wakeups, 1, memory_order_relaxed);
+}
+
+bool park_ring(record_ring *r) {
+  atomic_store_explicit(&r->need_wakeup, true, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (count_ring(r) == 0)
+    return true;
+  atomic_store_explicit(&r->need_wakeup, false, memory_order_relaxed);
+  return false;
+}
+
+void unpark_ring(record_ring *r) {
+  atomic_store_explicit(&r->need_wakeup, false, memory_order_relaxed);
+}
+
+bool ack_ring(record_ring *r) {
+  uint64_t u;
+  if (read(r->fd, &u, sizeof(uint64_t)) == -1 && errno != EAGAIN &&
+      errno != EINTR)
+    return false;
+  return true;
+}
@@ -0,0 +1,54 @@
+#include "events/event_loop.h"
+#include "events/ring.h"
+#include "utils.h"
+#include "waymo/rings.h"
+
+// Claims room for up to count completions so the loop never finds the
+// completion ring full
+static unsigned int reserve_inflight(waymo_event_loop *loop,
+                                     unsigned int count) {
+  unsigned int limit = loop->cq->entries;
+  unsigned int cur =
+      atomic_load_explicit(&loop->ring_inflight, memory_order_relaxed);
+  unsigned int take;
+  do {
+    if (cur >= limit)
+      return 0;
+    take = limit - cur < count ? limit - cur : count;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &loop->ring_inflight, &cur, cur + take, memory_order_relaxed,
+      memory_order_relaxed));
+  return take;
+}
+
+unsigned int waymo_ring_submit(waymo_event_loop *loop, const waymo_sqe *sqes,
+                               unsigned int count) {
+  if (unlikely(!loop || !loop->sq || !sqes || count == 0))
+    return 0;
+
+  unsigned int reserved = reserve_inflight(loop, count);
+  unsigned int pushed = 0;
+  while (pushed < reserved && push_ring(loop->sq, &sqes[pushed]))
+    pushed++;
+  if (pushed < reserved)
+    atomic_fetch_sub_explicit(&loop->ring_inflight, reserved - pushed,
+                              memory_order_relaxed);
+
+  // One check for the whole run rather than one per record
+  if (pushed)
+    kick_ring(loop->sq);
+  return pushed;
+}
+
+unsigned int waymo_ring_reap(waymo_event_loop *loop, waymo_cqe *cqes,
+                             unsigned int max) {
+  if (unlikely(!loop || !loop->cq || !cqes))
+    return 0;
+
+  unsigned int got = 0;
+  while (got < max && pop_ring(loop->cq, &cqes[got]))
+    got++;
+  if (got)
+    atomic_fetch_sub_explicit(&loop->ring_inflight, got, memory_order_relaxed);
+  return got;
+}
@@ -5,10 +5,15 @@
 #include <atomic>
 #define WAYMO_ATOMIC(t) std::atomic<t>
 #define WAYMO_ATOMIC_BOOL std::atomic<bool>
+#define WAYMO_ALIGNAS(n) alignas(n)
 #else
 #include <stdatomic.h>
 #define WAYMO_ATOMIC(t) _Atomic t
 #define WAYMO_ATOMIC_BOOL atomic_bool
+#define WAYMO_ALIGNAS(n) _Alignas(n)
 #endif
 
+// Keeps atomics written by different threads off the same cache line
+#define WAYMO_CACHELINE 64
+
 #endif
@@ -4,17 +4,30 @@
 #include "waymo/actions_internal.h"
 #include "waymo/btns.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 struct waymoctx;
 struct waymo_event_loop;
+struct batch_run;
+struct waymo_sqe;
+struct object_pool;
+
+// Intervals used when the caller does not pass one. Commands store every
+// duration in nanoseconds, converted when they are created
+#define DEFAULT_KEY_INTERVAL_MS 0 // Held keys are repeated by the client
+#define DEFAULT_HOLD_INTERVAL_MS 10
+#define DEFAULT_TYPE_INTERVAL_MS 10
 
 typedef enum {
-  CMD_MOUSE_MOVE,    // Takes x, y and if movement should be relative
-  CMD_MOUSE_CLICK,   // Takes the button and num clicks
-  CMD_MOUSE_BTN,     // Takes button and if down
-  CMD_KEYBOARD_TYPE, // Takes key and num clicks
-  CMD_KEYBOARD_KEY,  // Takes key and if down
+  CMD_MOUSE_MOVE,        // Takes x, y and if movement should be relative
+  CMD_MOUSE_CLICK,       // Takes the button and num clicks
+  CMD_MOUSE_BTN,         // Takes button and if down
+  CMD_KEYBOARD_TYPE,     // Takes key and num clicks
+  CMD_KEYBOARD_KEY,      // Takes key and if down
+  CMD_KEYBOARD_SHORTCUT, // Takes key and the KMODS held around it
+  CMD_BATCH,             // Takes a list of commands to run in order
+  CMD_CANCEL,            // Takes the ticket to stop, 0 for every action
   CMD_QUIT,
 } command_type;
 
@@ -31,37 +44,93 @@ typedef union {
   struct {
     MBTNS button;
     unsigned int clicks;
-    uint32_t click_ms;
+    uint64_t click_ns;
   } mouse_click;
   struct {
     MBTNS button;
     bool down;
   } mouse_btn;
   struct {
-    char key;
+    uint32_t key; // Unicode code point
     enum KMODOPT active_opt;
-    uint32_t *interval_ms;
+    uint64_t interval_ns;
     union {
       bool down;
-      uint32_t hold_ms;
+      uint64_t hold_ns;
     } keyboard_key_mod;
   } keyboard_key;
   struct {
-    char *txt;
-    uint32_t *interval_ms;
+    uint32_t key; // Unicode code point
+    unsigned int mods;
+  } shortcut;
+  struct {
+    uint32_t *cps; // Decoded once on creation, ekbd_type takes ownership
+    size_t len;
+    uint64_t interval_ns;
   } kbd;
+  struct {
+    struct command **cmds;
+    size_t len;
+    size_t cap;
+  } batch;
+  struct {
+    action_ticket ticket;
+  } cancel;
 } command_param;
 
+// Who to tell once a command has fully finished
+typedef struct {
+  int fd;                  // Eventfd of a waiting caller or -1
+  struct batch_run *batch; // Batch to resume or NULL
+  action_done_cb cb;       // Async callback or NULL
+  void *user_data;
+  action_ticket ticket;
+  bool post_cqe;     // Post cqe_data to the loop's completion ring
+  uint64_t cqe_data;
+} completion;
+
+// A completion held back until the loop has flushed the tick it finished in
+typedef struct {
+  completion done;
+  action_result result;
+  uint64_t staged; // waymoctx::staged_seq when it finished
+} finished_action;
+
 typedef struct command {
   command_type type;
   command_param param;
-  int done_fd;
+  completion done;
+  struct object_pool *pool; // Where free_command returns it, NULL for the heap
 } command;
 
 void execute_command(struct waymo_event_loop *loop, struct waymoctx *ctx,
                      command *cmd);
+void signal_completion(struct waymo_event_loop *loop, struct waymoctx *ctx,
+                       completion done, action_result result);
+// Frees the batches done runs in, returning the completion of the outermost
+completion release_completion(completion done);
+// Ticket of the command done belongs to, for a batch step that of the batch
+action_ticket completion_ticket(completion done);
+// Moves held batches on once their keys are sent, commits the tick's requests
+// then delivers the completions held back for it
+void flush_tick(struct waymo_event_loop *loop, struct waymoctx *ctx);
+// Delivers the held back completions whose keys are no longer staged, as
+// failed ones if the tick could not be sent
+void deliver_finished(struct waymo_event_loop *loop, struct waymoctx *ctx,
+                      bool sent);
+// Drops the batches waiting on staged keys that belong to ticket, or every one
+// when it is 0, and tells their callers RESULT_CANCELLED. Returns false if
+// there were none
+bool cancel_held_batches(struct waymo_event_loop *loop, struct waymoctx *ctx,
+                         action_ticket ticket);
 
 void free_command(command *cmd);
+// Frees what a command owns, such as its decoded text, but not the command
+void clear_command(command *cmd);
+// Fills a caller owned command from a ring record. The text of a type record
+// is decoded into memory of its own, so the command is passed to clear_command
+// once it has run, never to free_command
+bool command_from_sqe(const struct waymo_sqe *sqe, command *cmd);
 
 command *create_quit_cmd();
 
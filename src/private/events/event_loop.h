@@ -1,7 +1,10 @@
 #ifndef ELT_H
 #define ELT_H
 
+#include "events/pool.h"
 #include "events/queue.h"
+#include "events/ring.h"
+#include "events/u64_map.h"
 #include "waymo/events.h"
 #include <semaphore.h>
 #include <stdatomic.h>
@@ -14,8 +17,56 @@ typedef struct waymo_event_loop {
   sem_t ready_sem;
   int timer_fd;
   pthread_mutex_t pending_mutex;
-  struct pending_action *pending_head;
-  uint32_t action_cooldown_ms;
+  // Min-heap of pending actions ordered by expiry, guarded by pending_mutex
+  struct pending_action **pending;
+  size_t pending_len;
+  size_t pending_cap;
+  uint64_t pending_seq;
+  // Pending action of every command that has one, in ptr, by the ticket of
+  // the command or of the outermost batch it runs in. Only actions scheduled
+  // by the loop thread carry one so only that thread touches it
+  u64_map tickets;
+  // Commands are only taken once cooldown_until_ns has passed. While they are
+  // held back intake_deferred is set and timer_fd also covers the cooldown.
+  // All three are only touched by the loop thread
+  uint64_t cooldown_ns;
+  uint64_t cooldown_until_ns;
+  bool intake_deferred;
+  // Keys and buttons pressed down and not released yet, loop thread only.
+  // Keys are by the evdev keycode sent, with u32 the key as sent (see
+  // KEY_PACK) and ptr any repeat scheduled for it. Button n is bit n -
+  // BTN_MOUSE
+  u64_map held;
+  uint8_t held_buttons;
+  // Completions waiting for the end of the tick, loop thread only
+  finished_action *finished;
+  size_t finished_len;
+  size_t finished_cap;
+  // Batches whose last step left keys staged, loop thread only. Each waits
+  // for them to be sent before it runs its next step
+  struct batch_run *held_batches;
+  WAYMO_ATOMIC(action_ticket) next_ticket;
+  // Timer accuracy, only written by the loop thread
+  WAYMO_ATOMIC(uint64_t) timer_fired;
+  WAYMO_ATOMIC(uint64_t) timer_late_ns;
+  WAYMO_ATOMIC(uint64_t) timer_max_late_ns;
+  WAYMO_ATOMIC(uint64_t) timer_skipped;
+  // Keymap counters, only written by the loop thread
+  unsigned int keymap_capacity;
+  unsigned int type_burst;
+  bool keymap_cache;
+  WAYMO_ATOMIC(uint64_t) keymap_uploads;
+  WAYMO_ATOMIC(uint64_t) keymap_upload_bytes;
+  WAYMO_ATOMIC(uint64_t) keymap_last_upload_bytes;
+  WAYMO_ATOMIC(uint64_t) keymap_evictions;
+  // Recycled commands and pending actions, NULL when sized to 0
+  object_pool *cmd_pool;
+  object_pool *pending_pool;
+  // Optional rings, NULL unless eloop_params::ring_entries was set
+  record_ring *sq;
+  record_ring *cq;
+  // Submitted ring actions whose completion has not been reaped yet
+  WAYMO_ALIGNAS(WAYMO_CACHELINE) WAYMO_ATOMIC(unsigned int) ring_inflight;
 } waymo_event_loop;
 
 #endif
@@ -16,10 +16,16 @@ enum action_type {
   ACTION_KEY_HOLD,
 };
 
+// What a periodic action does when the loop wakes up a whole period late
+enum late_policy {
+  LATE_CATCH_UP, // Fire the missed ticks back to back, nothing is dropped
+  LATE_SKIP,     // Drop the missed ticks and rejoin the schedule
+};
+
 struct pending_action {
-  uint64_t expiry_ms;
+  uint64_t expiry_ns; // Absolute CLOCK_MONOTONIC deadline
   enum action_type type;
-  int done_fd;
+  completion done;
   union {
     struct {
       uint32_t keycode;
@@ -29,32 +35,81 @@ struct pending_action {
     } mouse;
     struct {
       uint32_t button;
-      uint32_t ms;
+      uint64_t ns;
       unsigned int remaining;
       bool is_down;
     } click;
     struct {
-      char *txt;
-      unsigned int index;
-      uint32_t interval_ms;
+      uint32_t *codes; // Resolved before the first key so none stall typing
+      size_t len;
+      size_t index;
+      uint64_t interval_ns;
     } type_txt;
     struct {
       uint32_t keycode;
-      uint32_t repeat_interval_ms;
-      uint32_t total_hold_ms;
-      uint32_t elapsed_ms;
+      uint64_t repeat_interval_ns;
+      uint64_t total_hold_ns;
     } key_repeat;
     struct {
       uint32_t keycode;
-      uint32_t interval_ms;
+      uint64_t interval_ns;
     } key_hold;
   } data;
-  struct pending_action *next;
+  // Periodic actions are due at start_ns + tick * interval so the time spent
+  // handling one tick never delays the next
+  uint64_t start_ns;
+  uint64_t tick;
+  enum late_policy late;
+  size_t heap_index;    // Position in loop->pending
+  uint64_t seq;         // Breaks ties between actions due at the same time
+  action_ticket ticket; // Key in loop->tickets, 0 for none
 };
 
+// Pending actions come from the loop's pool, falling back to the heap when it
+// is exhausted. free_pending also takes actions allocated with malloc
+struct pending_action *alloc_pending(waymo_event_loop *loop);
+void free_pending(waymo_event_loop *loop, struct pending_action *act);
+
+// Sets up the schedule of a periodic action and its first deadline
+static inline void start_periodic(struct pending_action *act, uint64_t start_ns,
+                                  uint64_t first_tick, uint64_t interval_ns,
+                                  enum late_policy late) {
+  act->start_ns = start_ns;
+  act->tick = first_tick;
+  act->late = late;
+  act->expiry_ns = start_ns + first_tick * interval_ns;
+}
+
 void update_timer(waymo_event_loop *loop);
-void schedule_action(waymo_event_loop *loop, struct pending_action *action);
+// Returns false if the heap could not grow, the action is then still owned by
+// the caller
+bool schedule_action(waymo_event_loop *loop, struct pending_action *action);
+
+// Heap operations for callers already holding pending_mutex
+bool schedule_action_locked(waymo_event_loop *loop,
+                            struct pending_action *action);
+struct pending_action *pop_pending_locked(waymo_event_loop *loop);
+void remove_pending_locked(waymo_event_loop *loop, struct pending_action *act);
+
+static inline struct pending_action *peek_pending(waymo_event_loop *loop) {
+  return loop->pending_len ? loop->pending[0] : NULL;
+}
+
 void clear_pending_actions(waymo_event_loop *loop);
+// Stops the pending action or held batch of ticket, or every one of them and
+// every held key and button when it is 0, dropping staged presses too.
+// Whatever they left pressed is released and their callers are told
+// RESULT_CANCELLED. Returns false if ticket had neither
+bool cancel_actions(waymo_event_loop *loop, waymoctx *ctx,
+                    action_ticket ticket);
+
+// Lets go of a key put down by press_key and drops its repeat in O(1). A key
+// that was never held is still released
+void release_held_key(waymo_event_loop *loop, waymoctx *ctx, uint32_t key);
+// Lets go of every held key so none stays down once the loop is gone
+void release_held_keys(waymo_event_loop *loop, waymoctx *ctx);
+// Same for the buttons put down by press_mouse
+void release_held_buttons(waymo_event_loop *loop, waymoctx *ctx);
 void handle_timer_expiry(waymo_event_loop *loop, waymoctx *ctx);
 
 #endif
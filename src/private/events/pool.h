@@ -0,0 +1,32 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "events/atomic_compat.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed number of equally sized objects carved from one allocation. Objects
+// can be taken and returned from any thread, the free list is a stack of
+// indices whose head carries a tag so a concurrent pop and push cannot ABA
+typedef struct object_pool {
+  unsigned char *objs;
+  size_t stride;
+  unsigned int capacity;
+  WAYMO_ATOMIC(uint32_t) *next; // Free list links, index + 1 or 0 for none
+  WAYMO_ATOMIC(uint64_t) misses;
+  // Slots handed out at least once, which is also the most ever live at once
+  WAYMO_ALIGNAS(WAYMO_CACHELINE) WAYMO_ATOMIC(unsigned int) carved;
+  WAYMO_ALIGNAS(WAYMO_CACHELINE) WAYMO_ATOMIC(uint64_t) head;
+} object_pool;
+
+object_pool *create_pool(unsigned int capacity, size_t obj_size);
+void destroy_pool(object_pool *p);
+
+// Returns NULL and counts a miss once every object is in use
+void *pool_get(object_pool *p);
+void pool_put(object_pool *p, void *obj);
+bool pool_owns(const object_pool *p, const void *obj);
+unsigned int pool_high_water(object_pool *p);
+
+#endif
@@ -3,18 +3,28 @@
 
 #include "events/atomic_compat.h"
 #include "events/commands.h"
-#include <pthread.h>
 #include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 
+// A slot is free for the producer claiming position p when seq == p and holds
+// a command for the consumer at position p when seq == p + 1
 typedef struct {
-  command **commands;
-  unsigned int num_commands;
-  unsigned int front;
-  unsigned int back;
+  WAYMO_ATOMIC(size_t) seq;
+  command *cmd;
+} queue_slot;
+
+// Bounded lock-free ring, many producers and one consumer (the event loop)
+typedef struct {
+  queue_slot *slots;
   unsigned int max_capacity;
-  pthread_mutex_t mutex;
   int fd;
   WAYMO_ATOMIC_BOOL shutdown;
+  // Set while a wakeup is sitting in fd that the loop has not acked yet
+  WAYMO_ATOMIC_BOOL signalled;
+  WAYMO_ATOMIC(uint64_t) wakeups;
+  WAYMO_ALIGNAS(WAYMO_CACHELINE) WAYMO_ATOMIC(size_t) back;
+  WAYMO_ALIGNAS(WAYMO_CACHELINE) WAYMO_ATOMIC(size_t) front;
 } command_queue;
 
 command_queue *create_queue(unsigned int max_commands);
@@ -22,5 +32,15 @@ void destroy_queue(command_queue *q);
 
 bool add_queue(command_queue *q, command *cmd);
 command *remove_queue(command_queue *q);
+// The command remove_queue would return, left in place. Consumer only
+command *peek_queue(command_queue *q);
+unsigned int count_queue(command_queue *q);
+bool ack_queue(command_queue *q);
+// Clears a wakeup but leaves the queue signalled so producers stop writing fd,
+// for when the loop is not going to drain it yet. ack_queue before draining
+bool mute_queue(command_queue *q);
+// Marks the queue signalled without writing fd so producers stop waking the
+// loop, for when its head cannot run yet. ack_queue undoes it
+void hold_queue(command_queue *q);
 
 #endif
@@ -0,0 +1,43 @@
+#ifndef RING_H
+#define RING_H
+
+#include "events/atomic_compat.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded lock-free ring of fixed size records copied in and out by value.
+// Slots follow the same sequence scheme as the command queue and each one is
+// padded to whole cache lines so neighbouring records never share one
+typedef struct {
+  unsigned char *slots;
+  size_t stride;
+  size_t record_size;
+  unsigned int entries;
+  int fd; // Only used to wake a parked consumer, -1 when never parked
+  // Set by a consumer about to block, cleared by whoever wakes it
+  WAYMO_ATOMIC_BOOL need_wakeup;
+  WAYMO_ATOMIC(uint64_t) wakeups;
+  WAYMO_ALIGNAS(WAYMO_CACHELINE) WAYMO_ATOMIC(size_t) back;
+  WAYMO_ALIGNAS(WAYMO_CACHELINE) WAYMO_ATOMIC(size_t) front;
+} record_ring;
+
+record_ring *create_ring(unsigned int entries, size_t record_size,
+                         bool parkable);
+void destroy_ring(record_ring *r);
+
+// Both return false without blocking when the ring is full or empty
+bool push_ring(record_ring *r, const void *record);
+bool pop_ring(record_ring *r, void *record);
+unsigned int count_ring(record_ring *r);
+
+// Wakes the consumer if it is parked, called once after a run of pushes
+void kick_ring(record_ring *r);
+// Returns false if records arrived in the meantime and the caller must not
+// block. Otherwise every later kick_ring writes fd until unpark_ring
+bool park_ring(record_ring *r);
+void unpark_ring(record_ring *r);
+// Clears a wakeup once the loop has seen fd become readable
+bool ack_ring(record_ring *r);
+
+#endif
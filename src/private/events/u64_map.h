@@ -0,0 +1,33 @@
+#ifndef U64_MAP_H
+#define U64_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define U64_MAP_EMPTY UINT64_MAX // The one key that cannot be stored
+
+// Linear probing hash from 64 bit keys to a pointer, a 32 bit value or both,
+// for the small loop thread indexes that must not cost a scan. Kept at most
+// half full so runs stay short
+struct u64_entry {
+  uint64_t key; // U64_MAP_EMPTY in a free slot
+  void *ptr;
+  uint32_t u32;
+};
+
+typedef struct {
+  struct u64_entry *slots;
+  size_t cap; // Zero or a power of two
+  size_t len;
+} u64_map;
+
+struct u64_entry *u64_map_get(const u64_map *m, uint64_t key);
+// Returns the entry of key, added with a NULL ptr and a zero u32 if it had
+// none, or NULL if memory ran out. Entries move on every put and take
+struct u64_entry *u64_map_put(u64_map *m, uint64_t key);
+// Removes key and copies its entry to out if given, false if it had none
+bool u64_map_take(u64_map *m, uint64_t key, struct u64_entry *out);
+void u64_map_clear(u64_map *m);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Decodes len bytes of UTF-8 into code points, out needs room for len of them.
+// Does not depend on the locale. A byte that does not start a valid sequence
+// decodes to its own value so nothing is silently dropped. Returns the number
+// of code points written
+size_t utf8_decode(const char *s, size_t len, uint32_t *out);
+
+#endif
@@ -9,13 +9,24 @@
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
+#define MS_TO_NS(ms) ((uint64_t)(ms) * 1000000)
+#define US_TO_NS(us) ((uint64_t)(us) * 1000)
+
+// Millisecond clock for protocol event times
 static inline uint64_t timestamp() {
   struct timespec ts;
   clock_gettime(CLOCK_MONOTONIC, &ts);
   return (uint64_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
 }
 
-static inline void signal_done(int fd, unsigned int sleepms) {
+// Nanosecond clock for the pending action scheduler, same clock as timer_fd
+static inline uint64_t timestamp_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static inline void signal_done(int fd) {
   if (fd < 0)
     return;
   uint64_t sig = 1;
@@ -24,7 +35,6 @@ static inline void signal_done(int fd, unsigned int sleepms) {
       continue;
     break;
   }
-  usleep(sleepms * 1000);
 }
 
 #endif
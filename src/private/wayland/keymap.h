@@ -0,0 +1,98 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include "events/u64_map.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+
+struct keymap_entry {
+  xkb_keysym_t xkb;
+  wchar_t wchr;
+  uint64_t used; // Last lookup, for picking which keycode to recycle
+  uint32_t pins; // Pending actions that still send this keycode
+};
+
+#define KEYCODE_NONE UINT32_MAX
+
+// A key as sent is its evdev keycode, with the top byte picking the modifiers
+// that select its level from waymoctx::mod_masks. 0 there means none
+#define KEY_CODE(key) ((key) & 0xffffffu)
+#define KEY_MODS(key) ((key) >> 24)
+#define KEY_PACK(code, mods) ((uint32_t)(code) | ((uint32_t)(mods) << 24))
+#define KEY_MODS_MAX 255 // All ones is KEYCODE_NONE
+#define KEYCODE_PAGES 256 // The BMP in pages of 256 characters
+
+// Finds the keycode of a character without scanning the keymap. The BMP is a
+// two level table whose pages are allocated on first use and hold keycode + 1
+// so 0 means empty, anything above it goes into astral with u32 the keycode
+typedef struct {
+  uint32_t *bmp[KEYCODE_PAGES];
+  u64_map astral;
+} keycode_index;
+
+uint32_t keycode_index_get(const keycode_index *idx, wchar_t ch);
+// Returns false if memory ran out, the index is unchanged then
+bool keycode_index_put(keycode_index *idx, wchar_t ch, uint32_t code);
+void keycode_index_remove(keycode_index *idx, wchar_t ch);
+void keycode_index_clear(keycode_index *idx);
+
+// Keymap compiled from the configured layout. Dynamic keys are spliced in
+// after its keycodes and symbols so both go out in one upload
+struct keymap_layout {
+  char *text; // From xkb_keymap_get_as_string, or inside map
+  size_t len;
+  void *map; // Cache file the layout was loaded from, NULL if compiled
+  size_t map_len;
+  size_t max_at, max_end; // Digits of its maximum keycode
+  size_t keycodes_end;    // Closing brace of xkb_keycodes
+  size_t symbols_end;     // Closing brace of xkb_symbols
+  uint32_t first;         // One past the layout's maximum XKB keycode
+  // XKB keycodes up to 255 the layout leaves unnamed. Dynamic keys take these
+  // first since many clients ignore anything above 255, and only then go on
+  // from first. spare_slot maps a keycode back to its index in spare, plus 1
+  uint8_t spare[256];
+  uint8_t spare_slot[256];
+  size_t spare_len;
+};
+
+// Takes ownership of text. Returns false, freeing it, if the sections to
+// splice into cannot be found
+bool keymap_layout_init(struct keymap_layout *layout, char *text,
+                        uint32_t max_keycode);
+// Fills in spare from the keycodes the layout text names
+void keymap_layout_find_spare(struct keymap_layout *layout);
+void keymap_layout_clear(struct keymap_layout *layout);
+
+// A character the layout types, as the key to send for it
+struct layout_key {
+  uint32_t cp;
+  uint32_t key;
+};
+
+// Opt-in cache of compiled layouts under $XDG_CACHE_HOME/waymo, one file per
+// layout and library version. A hit maps the file, layout and keys then point
+// into it until keymap_layout_clear
+bool keymap_cache_load(const char *name, struct keymap_layout *layout,
+                       xkb_mod_mask_t *mods, unsigned int *mods_len,
+                       const struct layout_key **keys, size_t *keys_len);
+void keymap_cache_store(const char *name, const struct keymap_layout *layout,
+                        const xkb_mod_mask_t *mods, unsigned int mods_len,
+                        const struct layout_key *keys, size_t keys_len);
+
+// Upper bound of keymap_text for len entries. Without a layout the keymap
+// holds only the dynamic keys, starting at keycode 8
+size_t keymap_text_size(const struct keymap_layout *layout, size_t len);
+// Writes the XKB keymap for keymap into buf, which must hold at least
+// keymap_text_size(layout, len) bytes. Returns the length written, without a
+// NUL. layout may be NULL
+size_t keymap_text(const struct keymap_layout *layout,
+                   const struct keymap_entry *keymap, size_t len, char *buf);
+// Returns a sealed memfd holding the NUL terminated keymap text, or -1. size
+// is set to the length to pass to the compositor, NUL included
+int keymap_memfd(const struct keymap_layout *layout,
+                 const struct keymap_entry *keymap, size_t len,
+                 uint32_t *size);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "events/commands.h"
 #include "events/event_loop.h"
+#include "wayland/keymap.h"
 #include "wvk.h"
 #include "wvp.h"
 #include <linux/input-event-codes.h>
@@ -11,6 +12,7 @@
 #include <xkbcommon/xkbcommon.h>
 
 typedef struct waymoctx {
+  waymo_event_loop *loop; // Owner, for its limits and counters. May be NULL
   struct wl_display *display;
   uint32_t screen_width;
   uint32_t screen_height;
@@ -23,13 +25,50 @@ typedef struct waymoctx {
   struct zwp_virtual_keyboard_v1 *kbd;
   struct zwlr_virtual_pointer_manager_v1 *pman;
   struct zwlr_virtual_pointer_v1 *ptr;
+  // Characters the configured layout cannot produce get a key of their own.
+  // Entries take the layout's spare keycodes first, then keymap_first onwards
+  struct keymap_layout layout;
   struct keymap_entry *keymap;
   size_t keymap_len;
+  uint32_t keymap_first;
+  keycode_index keycodes; // Character to key, see KEY_PACK
+  size_t keymap_base;     // Entries below this are never recycled
+  uint64_t keymap_clock;  // Stamps keymap_entry::used
+  // Modifiers that select each level the layout is typed with
+  xkb_mod_mask_t mod_masks[KEY_MODS_MAX];
+  unsigned int mod_masks_len;
+  xkb_mod_mask_t mods; // Depressed modifiers last sent to the compositor
+  // Keys sent down and not yet up with the modifiers each went down with. A
+  // release goes back to the modifiers the rest of them still need
+  struct down_key *down;
+  size_t down_len;
+  size_t down_cap;
+  // Keymap uploads are confirmed by a sync on this private queue. Until the
+  // newest one is answered key events wait in staged, in order
+  struct wl_event_queue *kbd_queue;
+  struct wl_display *kbd_display; // Display wrapper bound to kbd_queue
+  struct wl_callback *keymap_sync;
+  struct staged_key *staged;
+  size_t staged_len;
+  size_t staged_cap;
+  uint64_t staged_seq;   // Key events ever staged
+  uint64_t unstaged_seq; // staged_seq when staged was last sent
+  // Pointer events sent since the last frame. A frame holds at most one
+  // motion and one event per button so nothing in it overrides anything else
+  bool frame_open;
+  bool frame_motion;
+  uint32_t frame_buttons;
 } waymoctx;
 
-waymoctx *init_waymoctx(char *layout, _Atomic loop_status *status);
+waymoctx *init_waymoctx(waymo_event_loop *loop);
 void destroy_waymoctx(waymoctx *ctx);
 
+// Writes out every buffered request, waiting for room on the socket if needed.
+// Returns false once the connection is gone
+bool waymoctx_flush(waymoctx *ctx);
+// Ends the pointer frame and flushes, once per loop tick
+bool waymoctx_commit(waymoctx *ctx);
+
 bool waymoctx_connect(waymoctx *ctx, _Atomic loop_status *status);
 void waymoctx_destroy_connect(waymoctx *ctx);
 
@@ -41,16 +80,40 @@ void waymoctx_destroy_pointer(waymoctx *ctx);
 
 void emouse_move(waymoctx *ctx, command_param *param);
 void emouse_click(waymo_event_loop *loop, waymoctx *ctx, command_param *param,
-                  int fd);
-void emouse_btn(waymoctx *ctx, command_param *param);
+                  completion done);
+void emouse_btn(waymo_event_loop *loop, waymoctx *ctx, command_param *param);
+// Pointer events go through these so they are grouped into frames
+void waymoctx_ptr_button(waymoctx *ctx, uint32_t button, uint32_t state);
+void waymoctx_ptr_frame(waymoctx *ctx);
 
 void ekbd_type(waymo_event_loop *loop, waymoctx *ctx, command_param *param,
-               int fd);
+               completion done);
 void ekbd_key(waymo_event_loop *loop, waymoctx *ctx, command_param *param,
-              int fd);
+              completion done);
+void ekbd_shortcut(waymo_event_loop *loop, waymoctx *ctx, command_param *param,
+                   completion done);
 
+// Keys returned and taken below may carry modifiers, see KEY_PACK. Returns
+// KEYCODE_NONE if ch was missing and there was no memory to add it
 uint32_t waymoctx_get_keycode(waymoctx *ctx, wchar_t ch);
+// Replaces each code point in cps with its key. Missing characters share a
+// single keymap upload and every keycode written is pinned. Returns false,
+// with nothing left pinned, if one of them could not be added
+bool waymoctx_prepare_text(waymoctx *ctx, uint32_t *cps, size_t len);
 void waymoctx_upload_keymap(waymoctx *ctx);
+// Keycodes still needed by a pending action are never recycled
+void waymoctx_pin_key(waymoctx *ctx, uint32_t keycode);
+void waymoctx_unpin_keys(waymoctx *ctx, const uint32_t *keycodes, size_t n);
+// Sends a key event, or stages it while a keymap upload is unconfirmed
+void waymoctx_key(waymoctx *ctx, uint32_t keycode, uint32_t state);
+// Presses and releases a key with mods held on top of those of its level
+void waymoctx_chord(waymoctx *ctx, uint32_t keycode, xkb_mod_mask_t mods);
+// Sends whatever is staged without waiting any longer
+void waymoctx_unstage_keys(waymoctx *ctx);
+// Forgets staged presses. Releases stay so no key can end up stuck down
+void waymoctx_drop_staged_presses(waymoctx *ctx);
+// Handles keymap confirmations that have been read from the display
+void waymoctx_dispatch_kbd(waymoctx *ctx);
 
 static inline uint32_t mbtnstoliec(MBTNS btn) {
   switch (btn) {
@@ -65,9 +128,16 @@ static inline uint32_t mbtnstoliec(MBTNS btn) {
   }
 }
 
-struct keymap_entry {
-  xkb_keysym_t xkb;
-  wchar_t wchr;
+struct down_key {
+  uint32_t keycode;
+  xkb_mod_mask_t mods;
+};
+
+struct staged_key {
+  uint32_t time;
+  uint32_t keycode;
+  uint32_t state;
+  xkb_mod_mask_t mods; // Held with the key besides those of its level
 };
 
 #endif
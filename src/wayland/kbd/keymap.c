@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include "wayland/keymap.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define KEYSYM_NAME_MAX 64
+
+static const char keymap_head[] = "xkb_keymap {\n"
+                                  "xkb_keycodes \"(unnamed)\" {\n"
+                                  "  minimum = 8;\n"
+                                  "  maximum = ";
+static const char keymap_middle[] =
+    "};\n"
+    "xkb_types \"(unnamed)\" { include \"complete\" };\n"
+    "xkb_compatibility \"(unnamed)\" { include \"complete\" };\n"
+    "xkb_symbols \"(unnamed)\" {\n";
+static const char keymap_tail[] = "};\n};\n";
+
+// Longest line of each kind with 20 digit numbers and the longest keysym name
+#define KEYCODE_LINE_MAX (sizeof("  <K> = ;\n") + 40)
+#define SYMBOL_LINE_MAX (sizeof("  key <K> {[  ]};\n") + 20 + KEYSYM_NAME_MAX)
+
+static char *put_str(char *p, const char *s, size_t len) {
+  memcpy(p, s, len);
+  return p + len;
+}
+
+#define PUT_LIT(p, lit) put_str(p, lit, sizeof(lit) - 1)
+
+static char *put_uint(char *p, size_t v) {
+  char tmp[20];
+  size_t n = 0;
+  do {
+    tmp[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v);
+  while (n)
+    *p++ = tmp[--n];
+  return p;
+}
+
+// Same as printf's %04X
+static char *put_hex(char *p, uint32_t v) {
+  static const char digits[] = "0123456789ABCDEF";
+  char tmp[8];
+  size_t n = 0;
+  do {
+    tmp[n++] = digits[v & 0xf];
+    v >>= 4;
+  } while (v);
+  while (n < 4)
+    tmp[n++] = '0';
+  while (n)
+    *p++ = tmp[--n];
+  return p;
+}
+
+// Start of the last "};" in text[0, end), or end if there is none
+static size_t last_close(const char *text, size_t end) {
+  for (size_t i = end; i >= 2; i--)
+    if (text[i - 2] == '}' && text[i - 1] == ';')
+      return i - 2;
+  return end;
+}
+
+bool keymap_layout_init(struct keymap_layout *layout, char *text,
+                        uint32_t max_keycode) {
+  *layout = (struct keymap_layout){0};
+  if (!text)
+    return false;
+
+  // Relies on the layout of xkb_keymap_get_as_string: keycodes come first and
+  // close right before xkb_types, symbols close right before the keymap does
+  size_t len = strlen(text);
+  const char *max = strstr(text, "maximum = ");
+  const char *types = strstr(text, "\nxkb_types");
+  if (!max || !types || max > types) {
+    free(text);
+    return false;
+  }
+  layout->max_at = (size_t)(max - text) + sizeof("maximum = ") - 1;
+  layout->max_end = layout->max_at;
+  while (text[layout->max_end] >= '0' && text[layout->max_end] <= '9')
+    layout->max_end++;
+  layout->keycodes_end = last_close(text, (size_t)(types - text));
+  layout->symbols_end = last_close(text, last_close(text, len));
+  if (layout->max_end == layout->max_at ||
+      layout->keycodes_end == (size_t)(types - text) ||
+      layout->symbols_end <= layout->keycodes_end) {
+    free(text);
+    *layout = (struct keymap_layout){0};
+    return false;
+  }
+
+  layout->text = text;
+  layout->len = len;
+  layout->first = max_keycode + 1;
+  keymap_layout_find_spare(layout);
+  return true;
+}
+
+static size_t read_uint(const char *text, size_t i, size_t end, size_t *v) {
+  *v = 0;
+  while (i < end && text[i] >= '0' && text[i] <= '9')
+    *v = *v * 10 + (size_t)(text[i++] - '0');
+  return i;
+}
+
+void keymap_layout_find_spare(struct keymap_layout *layout) {
+  const char *text = layout->text;
+  size_t end = layout->keycodes_end;
+  bool named[256] = {false};
+  size_t min = 8, code;
+  const char *m = strstr(text, "minimum = ");
+  if (m && (size_t)(m - text) < end)
+    read_uint(text, (size_t)(m - text) + sizeof("minimum = ") - 1, end, &min);
+
+  // Keycodes are named on lines like "<AC01> = 38;". Aliases and indicators
+  // start with a word instead so they are passed over
+  for (size_t i = 0; i < end; i++) {
+    if (text[i] != '\n')
+      continue;
+    while (i + 1 < end && (text[i + 1] == ' ' || text[i + 1] == '\t'))
+      i++;
+    if (i + 1 >= end || text[i + 1] != '<')
+      continue;
+    while (i + 1 < end && text[i + 1] != '=' && text[i + 1] != '\n')
+      i++;
+    if (i + 1 >= end || text[i + 1] != '=')
+      continue;
+    i += 2;
+    while (i < end && text[i] == ' ')
+      i++;
+    if (read_uint(text, i, end, &code) > i && code < 256)
+      named[code] = true;
+  }
+
+  layout->spare_len = 0;
+  memset(layout->spare_slot, 0, sizeof(layout->spare_slot));
+  size_t max = layout->first - 1 < 255 ? layout->first - 1 : 255;
+  for (code = min < 8 ? 8 : min; code <= max; code++) {
+    if (named[code])
+      continue;
+    layout->spare[layout->spare_len] = (uint8_t)code;
+    layout->spare_slot[code] = (uint8_t)++layout->spare_len;
+  }
+}
+
+// XKB keycode of dynamic key i, see keymap_layout::spare
+static size_t entry_code(const struct keymap_layout *layout, size_t i) {
+  return i < layout->spare_len ? layout->spare[i]
+                               : layout->first + i - layout->spare_len;
+}
+
+void keymap_layout_clear(struct keymap_layout *layout) {
+  if (layout->map)
+    munmap(layout->map, layout->map_len);
+  else
+    free(layout->text);
+  *layout = (struct keymap_layout){0};
+}
+
+size_t keymap_text_size(const struct keymap_layout *layout, size_t len) {
+  size_t base = layout && layout->text
+                    ? layout->len + 20
+                    : sizeof(keymap_head) + 20 + sizeof(keymap_middle) +
+                          sizeof(keymap_tail);
+  return base + len * (KEYCODE_LINE_MAX + SYMBOL_LINE_MAX);
+}
+
+size_t keymap_text(const struct keymap_layout *layout,
+                   const struct keymap_entry *keymap, size_t len, char *buf) {
+  bool spliced = layout && layout->text;
+  char *p = buf;
+  if (spliced) {
+    p = put_str(p, layout->text, layout->max_at);
+    // The dynamic keys only ever raise the maximum
+    p = put_uint(p, len > layout->spare_len ? entry_code(layout, len - 1)
+                                            : layout->first - 1);
+    p = put_str(p, layout->text + layout->max_end,
+                layout->keycodes_end - layout->max_end);
+  } else {
+    p = PUT_LIT(p, keymap_head);
+    // Min is 8. Max must be at least 8 + len
+    p = put_uint(p, len + 8);
+    p = PUT_LIT(p, ";\n");
+  }
+
+  // Map key name <K#> to a spare keycode, or to # + 8 without a layout
+  for (size_t i = 0; i < len; i++) {
+    p = PUT_LIT(p, "  <K");
+    p = put_uint(p, i);
+    p = PUT_LIT(p, "> = ");
+    p = put_uint(p, spliced ? entry_code(layout, i) : i + 8);
+    p = PUT_LIT(p, ";\n");
+  }
+  if (spliced)
+    p = put_str(p, layout->text + layout->keycodes_end,
+                layout->symbols_end - layout->keycodes_end);
+  else
+    p = PUT_LIT(p, keymap_middle);
+
+  for (size_t i = 0; i < len; i++) {
+    p = PUT_LIT(p, "  key <K");
+    p = put_uint(p, i);
+    p = PUT_LIT(p, "> {[ ");
+    // The name goes straight into place, swapped for the hex value when the
+    // keysym has none
+    int n = xkb_keysym_get_name(keymap[i].xkb, p, KEYSYM_NAME_MAX);
+    if (n > 0 && n < KEYSYM_NAME_MAX && strcmp(p, "NoSymbol") != 0) {
+      p += n;
+    } else {
+      *p++ = 'U';
+      p = put_hex(p, (uint32_t)keymap[i].wchr);
+    }
+    p = PUT_LIT(p, " ]};\n");
+  }
+  if (spliced)
+    p = put_str(p, layout->text + layout->symbols_end,
+                layout->len - layout->symbols_end);
+  else
+    p = PUT_LIT(p, keymap_tail);
+  return (size_t)(p - buf);
+}
+
+int keymap_memfd(const struct keymap_layout *layout,
+                 const struct keymap_entry *keymap, size_t len,
+                 uint32_t *size) {
+  int fd = memfd_create("waymo-keymap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+    return -1;
+
+  // Sized for the worst case, then cut down to what was written
+  size_t cap = keymap_text_size(layout, len) + 1;
+  if (ftruncate(fd, (off_t)cap) < 0)
+    goto err_close;
+  char *buf = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (buf == MAP_FAILED)
+    goto err_close;
+  size_t written = keymap_text(layout, keymap, len, buf);
+  buf[written] = '\0';
+  munmap(buf, cap);
+
+  // The compositor maps it read only, sealing stops anyone changing it under
+  // that mapping
+  if (ftruncate(fd, (off_t)(written + 1)) < 0 ||
+      fcntl(fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+    goto err_close;
+  *size = (uint32_t)(written + 1);
+  return fd;
+
+err_close:
+  close(fd);
+  return -1;
+}
+
+uint32_t keycode_index_get(const keycode_index *idx, wchar_t ch) {
+  uint32_t c = (uint32_t)ch;
+  if (likely(c <= 0xffff)) {
+    const uint32_t *page = idx->bmp[c >> 8];
+    return page && page[c & 0xff] ? page[c & 0xff] - 1 : KEYCODE_NONE;
+  }
+  struct u64_entry *e = u64_map_get(&idx->astral, c);
+  return e ? e->u32 : KEYCODE_NONE;
+}
+
+bool keycode_index_put(keycode_index *idx, wchar_t ch, uint32_t code) {
+  uint32_t c = (uint32_t)ch;
+  if (c <= 0xffff) {
+    uint32_t **page = &idx->bmp[c >> 8];
+    if (!*page && !(*page = calloc(256, sizeof(uint32_t))))
+      return false;
+    (*page)[c & 0xff] = code + 1;
+    return true;
+  }
+  struct u64_entry *e = u64_map_put(&idx->astral, c);
+  if (!e)
+    return false;
+  e->u32 = code;
+  return true;
+}
+
+void keycode_index_remove(keycode_index *idx, wchar_t ch) {
+  uint32_t c = (uint32_t)ch;
+  if (c <= 0xffff) {
+    if (idx->bmp[c >> 8])
+      idx->bmp[c >> 8][c & 0xff] = 0;
+    return;
+  }
+  u64_map_take(&idx->astral, c, NULL);
+}
+
+void keycode_index_clear(keycode_index *idx) {
+  for (size_t i = 0; i < KEYCODE_PAGES; i++)
+    free(idx->bmp[i]);
+  u64_map_clear(&idx->astral);
+  *idx = (keycode_index){0};
+}
@@ -0,0 +1,167 @@
+#define _GNU_SOURCE
+#include "utils.h"
+#include "wayland/keymap.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef WAYMO_VERSION
+#define WAYMO_VERSION "unknown"
+#endif
+
+// Bumped whenever the file layout or what gets indexed changes
+#define CACHE_FORMAT 1
+static const char cache_magic[8] = "WAYMOKC";
+
+// Followed by the modifier masks, the keys and finally the keymap text. All
+// in native byte order, the cache never leaves the machine that wrote it
+struct cache_header {
+  char magic[8];
+  uint32_t format;
+  uint32_t first;
+  uint64_t text_len;
+  uint64_t max_at, max_end;
+  uint64_t keycodes_end, symbols_end;
+  uint32_t mods_len;
+  uint32_t keys_len;
+};
+
+// $XDG_CACHE_HOME/waymo, or ~/.cache/waymo, made if missing when create is set
+static bool cache_dir(char *dir, size_t size, bool create) {
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  // The spec says a relative XDG_CACHE_HOME is invalid and must be ignored
+  bool use_xdg = xdg && xdg[0] == '/';
+  if (!use_xdg && !(home && home[0] == '/'))
+    return false;
+  int n = use_xdg ? snprintf(dir, size, "%s", xdg)
+                  : snprintf(dir, size, "%s/.cache", home);
+  if (n < 0 || (size_t)n + sizeof("/waymo") > size)
+    return false;
+
+  if (create)
+    mkdir(dir, 0700);
+  strcat(dir, "/waymo");
+  if (create && mkdir(dir, 0700) < 0 && errno != EEXIST)
+    return false;
+  return true;
+}
+
+static bool cache_path(char *path, size_t size, const char *name,
+                       bool create) {
+  char dir[PATH_MAX];
+  if (!cache_dir(dir, sizeof(dir), create))
+    return false;
+  int n = snprintf(path, size, "%s/keymap-%s-v%s-%d", dir, name,
+                   WAYMO_VERSION, CACHE_FORMAT);
+  if (n < 0 || (size_t)n >= size)
+    return false;
+  // Layouts like "us(intl)" or "us,de" are fine in a file name, a slash is not
+  for (char *p = path + strlen(dir) + 1; *p; p++)
+    if (*p == '/')
+      *p = '_';
+  return true;
+}
+
+bool keymap_cache_load(const char *name, struct keymap_layout *layout,
+                       xkb_mod_mask_t *mods, unsigned int *mods_len,
+                       const struct layout_key **keys, size_t *keys_len) {
+  char path[PATH_MAX];
+  if (!cache_path(path, sizeof(path), name, false))
+    return false;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct cache_header))
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+
+  // Anything that does not add up is treated as a miss and rebuilt
+  size_t size = (size_t)st.st_size;
+  const struct cache_header *h = map;
+  size_t mods_size = (size_t)h->mods_len * sizeof(xkb_mod_mask_t);
+  size_t keys_size = (size_t)h->keys_len * sizeof(struct layout_key);
+  size_t text_at = sizeof(*h) + mods_size + keys_size;
+  if (memcmp(h->magic, cache_magic, sizeof(cache_magic)) != 0 ||
+      h->format != CACHE_FORMAT || h->mods_len == 0 ||
+      h->mods_len > KEY_MODS_MAX || text_at > size ||
+      h->text_len != size - text_at - 1 ||
+      ((const char *)map)[size - 1] != '\0' ||
+      h->max_at > h->max_end || h->max_end > h->keycodes_end ||
+      h->keycodes_end > h->symbols_end || h->symbols_end > h->text_len) {
+    munmap(map, size);
+    return false;
+  }
+
+  const char *base = map;
+  const struct layout_key *k =
+      (const struct layout_key *)(base + sizeof(*h) + mods_size);
+  for (size_t i = 0; i < h->keys_len; i++) {
+    // The slot indexes mod_masks when the key is sent
+    if (KEY_MODS(k[i].key) >= h->mods_len) {
+      munmap(map, size);
+      return false;
+    }
+  }
+  memcpy(mods, base + sizeof(*h), mods_size);
+  *mods_len = h->mods_len;
+  *keys = k;
+  *keys_len = h->keys_len;
+  *layout = (struct keymap_layout){
+      .text = (char *)base + text_at,
+      .len = h->text_len,
+      .map = map,
+      .map_len = size,
+      .max_at = h->max_at,
+      .max_end = h->max_end,
+      .keycodes_end = h->keycodes_end,
+      .symbols_end = h->symbols_end,
+      .first = h->first};
+  keymap_layout_find_spare(layout);
+  return true;
+}
+
+void keymap_cache_store(const char *name, const struct keymap_layout *layout,
+                        const xkb_mod_mask_t *mods, unsigned int mods_len,
+                        const struct layout_key *keys, size_t keys_len) {
+  char path[PATH_MAX], tmp[PATH_MAX];
+  if (!layout->text || !cache_path(path, sizeof(path), name, true) ||
+      snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+    return;
+  int fd = mkostemp(tmp, O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  struct cache_header h = {.format = CACHE_FORMAT,
+                           .first = layout->first,
+                           .text_len = layout->len,
+                           .max_at = layout->max_at,
+                           .max_end = layout->max_end,
+                           .keycodes_end = layout->keycodes_end,
+                           .symbols_end = layout->symbols_end,
+                           .mods_len = mods_len,
+                           .keys_len = (uint32_t)keys_len};
+  memcpy(h.magic, cache_magic, sizeof(cache_magic));
+  FILE *f = fdopen(fd, "w");
+  if (!f) {
+    close(fd);
+    unlink(tmp);
+    return;
+  }
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+            fwrite(mods, sizeof(*mods), mods_len, f) == mods_len &&
+            fwrite(keys, sizeof(*keys), keys_len, f) == keys_len &&
+            fwrite(layout->text, 1, layout->len + 1, f) == layout->len + 1;
+  // Readers only ever see a complete file, whoever renames last wins
+  if (fclose(f) != 0 || !ok || rename(tmp, path) < 0)
+    unlink(tmp);
+}
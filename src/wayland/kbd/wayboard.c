@@ -3,73 +3,434 @@
 #include "wayland/waycon.h"
 #include "wvk.h"
 #include <stdlib.h>
-#include <string.h>
 
-uint32_t waymoctx_get_keycode(waymoctx *ctx, wchar_t ch) {
-  // Search the existing keymap
-  for (uint32_t i = 0; i < ctx->keymap_len; i++) {
-    if (ctx->keymap[i].wchr == ch) {
-      return i;
+// Key that entry i of the keymap is sent as
+static uint32_t entry_key(waymoctx *ctx, size_t i) {
+  size_t spare = ctx->layout.spare_len;
+  return i < spare ? ctx->layout.spare[i] - 8u
+                   : ctx->keymap_first + (uint32_t)(i - spare);
+}
+
+// Entry of a key from the dynamic part of the keymap, NULL for layout keys
+static struct keymap_entry *dyn_entry(waymoctx *ctx, uint32_t key) {
+  size_t i;
+  if (KEY_MODS(key))
+    return NULL;
+  if (key >= ctx->keymap_first)
+    i = ctx->layout.spare_len + (key - ctx->keymap_first);
+  else if (key + 8 < 256 && ctx->layout.spare_slot[key + 8])
+    i = ctx->layout.spare_slot[key + 8] - 1u;
+  else
+    return NULL;
+  return i < ctx->keymap_len ? &ctx->keymap[i] : NULL;
+}
+
+// Appends to the keymap, the keycode of an entry is its position so entries
+// are never reordered
+static bool keymap_add(waymoctx *ctx, wchar_t ch, xkb_keysym_t ks) {
+  struct keymap_entry *keymap = realloc(
+      ctx->keymap, sizeof(struct keymap_entry) * (ctx->keymap_len + 1));
+  if (!keymap)
+    return false;
+  ctx->keymap = keymap;
+  if (!keycode_index_put(&ctx->keycodes, ch, entry_key(ctx, ctx->keymap_len)))
+    return false;
+  ctx->keymap[ctx->keymap_len] = (struct keymap_entry){
+      .xkb = ks, .wchr = ch, .used = ++ctx->keymap_clock};
+  ctx->keymap_len++;
+  return true;
+}
+
+// Least recently used entry that nothing pending still sends, or
+// KEYCODE_NONE when every one past the base keys is pinned
+static uint32_t keymap_coldest(waymoctx *ctx) {
+  uint32_t cold = KEYCODE_NONE;
+  uint64_t oldest = UINT64_MAX;
+  for (size_t i = ctx->keymap_base; i < ctx->keymap_len; i++) {
+    if (!ctx->keymap[i].pins && ctx->keymap[i].used < oldest) {
+      oldest = ctx->keymap[i].used;
+      cold = (uint32_t)i;
     }
   }
+  return cold;
+}
 
-  // Dynamic upload for missing characters
-  ctx->keymap =
-      realloc(ctx->keymap, sizeof(struct keymap_entry) * (ctx->keymap_len + 1));
-  ctx->keymap[ctx->keymap_len].wchr = ch;
-  ctx->keymap[ctx->keymap_len].xkb = xkb_utf32_to_keysym(ch);
-  ctx->keymap_len++;
+// Staged events are sent after the next upload, so their keys must keep the
+// mapping they were chosen under until then
+static void pin_staged(waymoctx *ctx, bool pin) {
+  for (size_t i = 0; i < ctx->staged_len; i++) {
+    struct keymap_entry *e = dyn_entry(ctx, ctx->staged[i].keycode);
+    if (e)
+      e->pins += pin ? 1 : -1;
+  }
+}
 
+// Gives ch a key, recycling the coldest one once the keymap is full. Returns
+// KEYCODE_NONE if there was no room for it
+static uint32_t keymap_claim(waymoctx *ctx, wchar_t ch) {
+  xkb_keysym_t ks = xkb_utf32_to_keysym(ch);
+  size_t cap = ctx->loop ? ctx->loop->keymap_capacity : 0;
+  uint32_t i = KEYCODE_NONE;
+  if (cap && ctx->keymap_len >= cap && ctx->keymap_len > ctx->keymap_base) {
+    pin_staged(ctx, true);
+    i = keymap_coldest(ctx);
+    pin_staged(ctx, false);
+  }
+
+  // Growing past the limit beats sending the wrong character
+  if (i == KEYCODE_NONE)
+    return keymap_add(ctx, ch, ks) ? entry_key(ctx, ctx->keymap_len - 1)
+                                   : KEYCODE_NONE;
+
+  uint32_t key = entry_key(ctx, i);
+  struct keymap_entry *e = &ctx->keymap[i];
+  keycode_index_remove(&ctx->keycodes, e->wchr);
+  if (!keycode_index_put(&ctx->keycodes, ch, key)) {
+    keycode_index_put(&ctx->keycodes, e->wchr, key);
+    return KEYCODE_NONE;
+  }
+  *e = (struct keymap_entry){
+      .xkb = ks, .wchr = ch, .used = ++ctx->keymap_clock};
+  atomic_fetch_add_explicit(&ctx->loop->keymap_evictions, 1,
+                            memory_order_relaxed);
+  return key;
+}
+
+static void keymap_touch(waymoctx *ctx, uint32_t key) {
+  struct keymap_entry *e = dyn_entry(ctx, key);
+  if (e)
+    e->used = ++ctx->keymap_clock;
+}
+
+uint32_t waymoctx_get_keycode(waymoctx *ctx, wchar_t ch) {
+  uint32_t key = keycode_index_get(&ctx->keycodes, ch);
+  if (likely(key != KEYCODE_NONE)) {
+    keymap_touch(ctx, key);
+    return key;
+  }
+
+  // Dynamic upload for missing characters. Without room for one there is no
+  // key, any other would type the wrong character
+  key = keymap_claim(ctx, ch);
+  if (key == KEYCODE_NONE)
+    return KEYCODE_NONE;
   waymoctx_upload_keymap(ctx);
+  return key;
+}
+
+void waymoctx_pin_key(waymoctx *ctx, uint32_t keycode) {
+  struct keymap_entry *e = dyn_entry(ctx, keycode);
+  if (e)
+    e->pins++;
+}
+
+void waymoctx_unpin_keys(waymoctx *ctx, const uint32_t *keycodes, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    struct keymap_entry *e = dyn_entry(ctx, keycodes[i]);
+    if (e && e->pins)
+      e->pins--;
+  }
+}
+
+bool waymoctx_prepare_text(waymoctx *ctx, uint32_t *cps, size_t len) {
+  bool added = false;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    wchar_t wc = (wchar_t)cps[i];
+
+    // Pinned straight away so a later character cannot recycle the keycode
+    // of an earlier one in the same string
+    uint32_t key = keycode_index_get(&ctx->keycodes, wc);
+    if (key == KEYCODE_NONE) {
+      key = keymap_claim(ctx, wc);
+      if (key == KEYCODE_NONE)
+        break;
+      added = true;
+    }
+    keymap_touch(ctx, key);
+    waymoctx_pin_key(ctx, key);
+    cps[i] = key;
+  }
+
+  // Keys claimed before a failure are in the index so they go out regardless
+  if (added)
+    waymoctx_upload_keymap(ctx);
+  if (i < len) {
+    waymoctx_unpin_keys(ctx, cps, i);
+    return false;
+  }
+  return true;
+}
+
+// Modifiers only go out when they change, so keys of one level typed in a row
+// or a chord of a key that needs no level cost nothing extra
+static void send_mods(waymoctx *ctx, xkb_mod_mask_t mods) {
+  if (mods == ctx->mods)
+    return;
+  zwp_virtual_keyboard_v1_modifiers(ctx->kbd, mods, 0, 0, 0);
+  ctx->mods = mods;
+}
+
+// Without room to track a key its modifiers are simply not restored
+static void key_down(waymoctx *ctx, uint32_t keycode, xkb_mod_mask_t mods) {
+  if (ctx->down_len == ctx->down_cap) {
+    size_t cap = ctx->down_cap ? ctx->down_cap * 2 : 8;
+    struct down_key *down = realloc(ctx->down, cap * sizeof(struct down_key));
+    if (!down)
+      return;
+    ctx->down = down;
+    ctx->down_cap = cap;
+  }
+  ctx->down[ctx->down_len++] =
+      (struct down_key){.keycode = KEY_CODE(keycode), .mods = mods};
+}
+
+// Forgets the key and returns the modifiers the keys still down need
+static xkb_mod_mask_t key_up(waymoctx *ctx, uint32_t keycode) {
+  xkb_mod_mask_t mods = 0;
+  for (size_t i = ctx->down_len; i-- > 0;) {
+    if (ctx->down[i].keycode == KEY_CODE(keycode)) {
+      ctx->down[i] = ctx->down[--ctx->down_len];
+      break;
+    }
+  }
+  for (size_t i = 0; i < ctx->down_len; i++)
+    mods |= ctx->down[i].mods;
+  return mods;
+}
+
+// The modifiers of a level are held only for as long as its key is
+static void send_key(waymoctx *ctx, const struct staged_key *ev) {
+  if (ev->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
+    xkb_mod_mask_t mods = ctx->mod_masks[KEY_MODS(ev->keycode)] | ev->mods;
+    send_mods(ctx, mods);
+    key_down(ctx, ev->keycode, mods);
+  }
+  zwp_virtual_keyboard_v1_key(ctx->kbd, ev->time, KEY_CODE(ev->keycode),
+                              ev->state);
+  if (ev->state == WL_KEYBOARD_KEY_STATE_RELEASED)
+    send_mods(ctx, key_up(ctx, ev->keycode));
+}
+
+void waymoctx_unstage_keys(waymoctx *ctx) {
+  for (size_t i = 0; i < ctx->staged_len; i++)
+    send_key(ctx, &ctx->staged[i]);
+  ctx->staged_len = 0;
+  ctx->unstaged_seq = ctx->staged_seq;
+}
+
+void waymoctx_drop_staged_presses(waymoctx *ctx) {
+  size_t kept = 0;
+  for (size_t i = 0; i < ctx->staged_len; i++)
+    if (ctx->staged[i].state == WL_KEYBOARD_KEY_STATE_RELEASED)
+      ctx->staged[kept++] = ctx->staged[i];
+  ctx->staged_len = kept;
+  if (!kept)
+    ctx->unstaged_seq = ctx->staged_seq;
+}
+
+static void handle_keymap_seen(void *data, struct wl_callback *cb,
+                               uint32_t serial) {
+  waymoctx *ctx = data;
+  wl_callback_destroy(cb);
+  ctx->keymap_sync = NULL;
+  waymoctx_unstage_keys(ctx);
+}
+
+static const struct wl_callback_listener keymap_sync_listener = {
+    .done = handle_keymap_seen,
+};
+
+void waymoctx_dispatch_kbd(waymoctx *ctx) {
+  if (ctx->kbd_queue)
+    wl_display_dispatch_queue_pending(ctx->display, ctx->kbd_queue);
+}
+
+static void queue_key(waymoctx *ctx, uint32_t keycode, uint32_t state,
+                      xkb_mod_mask_t mods) {
+  struct staged_key ev = {
+      .time = timestamp(), .keycode = keycode, .state = state, .mods = mods};
+  if (likely(!ctx->keymap_sync)) {
+    send_key(ctx, &ev);
+    return;
+  }
+
+  if (ctx->staged_len == ctx->staged_cap) {
+    size_t cap = ctx->staged_cap ? ctx->staged_cap * 2 : 32;
+    struct staged_key *staged =
+        realloc(ctx->staged, cap * sizeof(struct staged_key));
+    if (!staged) {
+      // Still ordered behind the keymap on the socket, only less cautious
+      waymoctx_unstage_keys(ctx);
+      send_key(ctx, &ev);
+      return;
+    }
+    ctx->staged = staged;
+    ctx->staged_cap = cap;
+  }
+  ctx->staged[ctx->staged_len++] = ev;
+  ctx->staged_seq++;
+}
+
+void waymoctx_key(waymoctx *ctx, uint32_t keycode, uint32_t state) {
+  queue_key(ctx, keycode, state, 0);
+}
 
-  return (uint32_t)(ctx->keymap_len + 7); // Last added keycode
+void waymoctx_chord(waymoctx *ctx, uint32_t keycode, xkb_mod_mask_t mods) {
+  queue_key(ctx, keycode, WL_KEYBOARD_KEY_STATE_PRESSED, mods);
+  queue_key(ctx, keycode, WL_KEYBOARD_KEY_STATE_RELEASED, mods);
 }
 
 void waymoctx_upload_keymap(waymoctx *ctx) {
-  char filename[] = "/tmp/waymo-XXXXXX";
-  int fd = mkstemp(filename);
+  // Nothing to send it to without a virtual keyboard
+  if (!ctx->kbd)
+    return;
+  uint32_t size;
+  int fd = keymap_memfd(&ctx->layout, ctx->keymap, ctx->keymap_len, &size);
   if (fd < 0)
     return;
-  unlink(filename);
-  FILE *f = fdopen(fd, "w");
-
-  fprintf(f, "xkb_keymap {\n");
-  // Min is 8. Max must be at least 8 + keymap_len
-  fprintf(f, "xkb_keycodes \"(unnamed)\" {\n  minimum = 8;\n  maximum = %zu;\n",
-          ctx->keymap_len + 8);
 
-  for (size_t i = 0; i < ctx->keymap_len; i++) {
-    // Map key name <K#> to keycode # + 8
-    fprintf(f, "  <K%zu> = %zu;\n", i, i + 8);
+  zwp_virtual_keyboard_v1_keymap(ctx->kbd, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, fd,
+                                 size);
+  if (ctx->loop) {
+    atomic_fetch_add_explicit(&ctx->loop->keymap_uploads, 1,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&ctx->loop->keymap_upload_bytes, size,
+                              memory_order_relaxed);
+    atomic_store_explicit(&ctx->loop->keymap_last_upload_bytes, size,
+                          memory_order_relaxed);
   }
-  fprintf(f, "};\n");
+  // The request holds its own copy of the fd so it can be closed right away.
+  // Rather than block on a round trip, keys wait until a sync sent after the
+  // keymap comes back. A newer upload supersedes any older sync
+  close(fd);
+  if (!ctx->kbd_display)
+    return;
+  if (ctx->keymap_sync)
+    wl_callback_destroy(ctx->keymap_sync);
+  ctx->keymap_sync = wl_display_sync(ctx->kbd_display);
+  if (ctx->keymap_sync)
+    wl_callback_add_listener(ctx->keymap_sync, &keymap_sync_listener, ctx);
+}
 
-  fprintf(f, "xkb_types \"(unnamed)\" { include \"complete\" };\n");
-  fprintf(f, "xkb_compatibility \"(unnamed)\" { include \"complete\" };\n");
+// Slot in mod_masks for mask, or KEYCODE_NONE once they are all taken
+static uint32_t mod_slot(waymoctx *ctx, xkb_mod_mask_t mask) {
+  for (unsigned int i = 0; i < ctx->mod_masks_len; i++)
+    if (ctx->mod_masks[i] == mask)
+      return i;
+  if (ctx->mod_masks_len == KEY_MODS_MAX)
+    return KEYCODE_NONE;
+  ctx->mod_masks[ctx->mod_masks_len] = mask;
+  return ctx->mod_masks_len++;
+}
+
+// Appends to a list of keys for the cache, dropping the list if memory runs
+// out since the cache is only ever an optimisation
+static void list_key(struct layout_key **keys, size_t *len, size_t *cap,
+                     uint32_t cp, uint32_t key) {
+  if (!*keys)
+    return;
+  if (*len == *cap) {
+    struct layout_key *grown = realloc(*keys, *cap * 2 * sizeof(**keys));
+    if (!grown) {
+      free(*keys);
+      *keys = NULL;
+      return;
+    }
+    *keys = grown;
+    *cap *= 2;
+  }
+  (*keys)[(*len)++] = (struct layout_key){.cp = cp, .key = key};
+}
 
-  fprintf(f, "xkb_symbols \"(unnamed)\" {\n");
-  for (size_t i = 0; i < ctx->keymap_len; i++) {
-    char name[64];
-    xkb_keysym_get_name(ctx->keymap[i].xkb, name, sizeof(name));
+// Compiles the layout and indexes every character it can type. Lower levels
+// are indexed first so a character never needs more modifiers than it must,
+// and the first key found wins within a level. Whatever was indexed is also
+// listed in keys when that is not NULL
+static bool layout_index(waymoctx *ctx, const char *layout,
+                         struct layout_key **keys, size_t *keys_len) {
+  struct xkb_context *xctx = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+  if (!xctx)
+    return false;
+  struct xkb_rule_names names = {.layout = layout};
+  struct xkb_keymap *km =
+      xkb_keymap_new_from_names(xctx, &names, XKB_KEYMAP_COMPILE_NO_FLAGS);
+  xkb_keycode_t min = km ? xkb_keymap_min_keycode(km) : 0;
+  xkb_keycode_t max = km ? xkb_keymap_max_keycode(km) : 0;
+  // Keycodes below 8 have no evdev code, above 24 bits they cannot be packed
+  if (!km || min < 8 || max - 8 > KEY_CODE(UINT32_MAX) ||
+      !keymap_layout_init(&ctx->layout,
+                          xkb_keymap_get_as_string(km,
+                                                   XKB_KEYMAP_FORMAT_TEXT_V1),
+                          max)) {
+    xkb_keymap_unref(km);
+    xkb_context_unref(xctx);
+    return false;
+  }
 
-    // Check if the name is valid or use the hex value
-    if (strcmp(name, "NoSymbol") == 0) {
-      fprintf(f, "  key <K%zu> {[ U%04X ]};\n", i,
-              (unsigned int)ctx->keymap[i].wchr);
-    } else {
-      fprintf(f, "  key <K%zu> {[ %s ]};\n", i, name);
+  size_t cap = 256;
+  if (keys)
+    *keys = malloc(cap * sizeof(**keys));
+  xkb_level_index_t levels = 1;
+  for (xkb_level_index_t lvl = 0; lvl < levels; lvl++) {
+    for (xkb_keycode_t kc = min; kc <= max; kc++) {
+      if (!xkb_keymap_num_layouts_for_key(km, kc))
+        continue;
+      xkb_level_index_t n = xkb_keymap_num_levels_for_key(km, kc, 0);
+      if (n > levels)
+        levels = n;
+      if (lvl >= n)
+        continue;
+
+      const xkb_keysym_t *syms;
+      if (xkb_keymap_key_get_syms_by_level(km, kc, 0, lvl, &syms) != 1)
+        continue;
+      uint32_t cp = xkb_keysym_to_utf32(syms[0]);
+      if (!cp || keycode_index_get(&ctx->keycodes, (wchar_t)cp) !=
+                     KEYCODE_NONE)
+        continue;
+
+      xkb_mod_mask_t mask = 0;
+      if (lvl && !xkb_keymap_key_get_mods_for_level(km, kc, 0, lvl, &mask, 1))
+        continue;
+      uint32_t slot = mod_slot(ctx, mask);
+      uint32_t key = KEY_PACK(kc - 8, slot);
+      if (slot != KEYCODE_NONE &&
+          keycode_index_put(&ctx->keycodes, (wchar_t)cp, key) && keys)
+        list_key(keys, keys_len, &cap, cp, key);
     }
   }
-  fprintf(f, "};\n};\n");
 
-  // Get size for the Wayland call
-  long size = ftell(f);
-  rewind(f);
+  xkb_keymap_unref(km);
+  xkb_context_unref(xctx);
+  return true;
+}
+
+// Takes the layout from the cache when asked to and it has it, compiling and
+// caching it otherwise
+static bool layout_load(waymoctx *ctx, const char *layout) {
+  if (!ctx->loop || !ctx->loop->keymap_cache)
+    return layout_index(ctx, layout, NULL, NULL);
+
+  const struct layout_key *cached;
+  size_t len = 0;
+  if (keymap_cache_load(layout, &ctx->layout, ctx->mod_masks,
+                        &ctx->mod_masks_len, &cached, &len)) {
+    for (size_t i = 0; i < len; i++)
+      keycode_index_put(&ctx->keycodes, (wchar_t)cached[i].cp, cached[i].key);
+    return true;
+  }
 
-  zwp_virtual_keyboard_v1_keymap(ctx->kbd, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
-                                 fileno(f), (uint32_t)size);
-  wl_display_roundtrip(ctx->display);
-  fclose(f);
+  struct layout_key *keys = NULL;
+  if (!layout_index(ctx, layout, &keys, &len)) {
+    free(keys);
+    return false;
+  }
+  if (keys)
+    keymap_cache_store(layout, &ctx->layout, ctx->mod_masks,
+                       ctx->mod_masks_len, keys, len);
+  free(keys);
+  return true;
 }
 
 bool waymoctx_kbd(waymoctx *ctx, char *layout) {
@@ -81,6 +442,22 @@ bool waymoctx_kbd(waymoctx *ctx, char *layout) {
 
   ctx->keymap = NULL;
   ctx->keymap_len = 0;
+  ctx->mod_masks_len = 1; // The first slot is no modifiers at all
+  ctx->mods = 0;
+
+  // Characters the layout types need no dynamic keys. Those fill the
+  // layout's spare keycodes and then go after its own, or make up the whole
+  // keymap without one
+  if (layout && layout_load(ctx, layout))
+    ctx->keymap_first = ctx->layout.first - 8;
+
+  // Without the private queue uploads are simply not waited on
+  ctx->kbd_queue = wl_display_create_queue(ctx->display);
+  if (ctx->kbd_queue) {
+    ctx->kbd_display = wl_proxy_create_wrapper(ctx->display);
+    if (ctx->kbd_display)
+      wl_proxy_set_queue((struct wl_proxy *)ctx->kbd_display, ctx->kbd_queue);
+  }
 
   // Add Special Control Keys
   struct {
@@ -91,28 +468,40 @@ bool waymoctx_kbd(waymoctx *ctx, char *layout) {
                   {L'\b', XKB_KEY_BackSpace},
                   {L' ', XKB_KEY_space}};
 
-  for (size_t i = 0; i < sizeof(specials) / sizeof(specials[0]); i++) {
-    ctx->keymap = realloc(ctx->keymap,
-                          sizeof(struct keymap_entry) * (ctx->keymap_len + 1));
-    ctx->keymap[ctx->keymap_len].wchr = specials[i].wc;
-    ctx->keymap[ctx->keymap_len].xkb = specials[i].ks;
-    ctx->keymap_len++;
-  }
+  for (size_t i = 0; i < sizeof(specials) / sizeof(specials[0]); i++)
+    if (keycode_index_get(&ctx->keycodes, specials[i].wc) == KEYCODE_NONE)
+      keymap_add(ctx, specials[i].wc, specials[i].ks);
 
-  // Add standard printable ASCII (33-126)
-  for (wchar_t wc = 33; wc <= 126; wc++) {
-    ctx->keymap = realloc(ctx->keymap,
-                          sizeof(struct keymap_entry) * (ctx->keymap_len + 1));
-    ctx->keymap[ctx->keymap_len].wchr = wc;
-    ctx->keymap[ctx->keymap_len].xkb = xkb_utf32_to_keysym(wc);
-    ctx->keymap_len++;
-  }
+  // Add whatever standard printable ASCII (33-126) the layout lacks
+  for (wchar_t wc = 33; wc <= 126; wc++)
+    if (keycode_index_get(&ctx->keycodes, wc) == KEYCODE_NONE)
+      keymap_add(ctx, wc, xkb_utf32_to_keysym(wc));
+  ctx->keymap_base = ctx->keymap_len;
 
   waymoctx_upload_keymap(ctx);
   return true;
 }
 
 void waymoctx_destroy_kbd(waymoctx *ctx) {
+  if (ctx->keymap_sync)
+    wl_callback_destroy(ctx->keymap_sync);
+  ctx->keymap_sync = NULL;
+  if (ctx->kbd_display)
+    wl_proxy_wrapper_destroy(ctx->kbd_display);
+  ctx->kbd_display = NULL;
+  if (ctx->kbd_queue)
+    wl_event_queue_destroy(ctx->kbd_queue);
+  ctx->kbd_queue = NULL;
+  free(ctx->staged);
+  ctx->staged = NULL;
+  ctx->staged_len = 0;
+  ctx->staged_cap = 0;
+  ctx->unstaged_seq = ctx->staged_seq;
+  free(ctx->down);
+  ctx->down = NULL;
+  ctx->down_len = 0;
+  ctx->down_cap = 0;
+
   if (ctx->kbd)
     zwp_virtual_keyboard_v1_destroy(ctx->kbd);
   ctx->kbd = NULL;
@@ -121,97 +510,181 @@ void waymoctx_destroy_kbd(waymoctx *ctx) {
     ctx->keymap = NULL;
   }
   ctx->keymap_len = 0;
+  ctx->keymap_base = 0;
+  ctx->keymap_first = 0;
+  ctx->mod_masks_len = 0;
+  ctx->mods = 0;
+  keymap_layout_clear(&ctx->layout);
+  keycode_index_clear(&ctx->keycodes);
 }
 
 void ekbd_key(waymo_event_loop *loop, waymoctx *ctx, command_param *param,
-              int fd) {
-  if (!ctx->kbd)
+              completion done) {
+  if (!ctx->kbd) {
+    signal_completion(loop, ctx, done, RESULT_FAILED);
     return;
+  }
 
-  // Convert char to wchar for broader support
-  wchar_t wc;
-  mbtowc(&wc, &param->keyboard_key.key, 1);
-  uint32_t keycode = waymoctx_get_keycode(ctx, wc);
+  wchar_t ch = (wchar_t)param->keyboard_key.key;
+  if (param->keyboard_key.active_opt == DOWN &&
+      !param->keyboard_key.keyboard_key_mod.down) {
+    // Only looked up, a key without one cannot be down and must not cost a
+    // keymap upload. Held keys are pinned so theirs is never recycled
+    uint32_t keycode = keycode_index_get(&ctx->keycodes, ch);
+    if (keycode != KEYCODE_NONE)
+      release_held_key(loop, ctx, keycode);
+    signal_completion(loop, ctx, done, RESULT_DONE);
+    return;
+  }
 
+  uint32_t keycode = waymoctx_get_keycode(ctx, ch);
+  if (keycode == KEYCODE_NONE) {
+    signal_completion(loop, ctx, done, RESULT_FAILED);
+    return;
+  }
   if (param->keyboard_key.active_opt == DOWN) {
-    bool down = param->keyboard_key.keyboard_key_mod.down;
-    uint32_t state =
-        down ? WL_KEYBOARD_KEY_STATE_PRESSED : WL_KEYBOARD_KEY_STATE_RELEASED;
-
-    zwp_virtual_keyboard_v1_key(ctx->kbd, timestamp(), keycode, state);
-    wl_display_flush(ctx->display);
-
-    // If pressing down, schedule spam press events
-    if (down) {
-      uint32_t repeat_interval_ms = param->keyboard_key.interval_ms
-                                        ? *param->keyboard_key.interval_ms
-                                        : 100;
-
-      struct pending_action *act = malloc(sizeof(struct pending_action));
+    // A key already down stays as it is, it is not pressed twice
+    if (u64_map_get(&loop->held, KEY_CODE(keycode))) {
+      signal_completion(loop, ctx, done, RESULT_DONE);
+      return;
+    }
+    struct u64_entry *held = u64_map_put(&loop->held, KEY_CODE(keycode));
+    if (!held) {
+      signal_completion(loop, ctx, done, RESULT_FAILED);
+      return;
+    }
+    held->u32 = keycode;
+    waymoctx_pin_key(ctx, keycode);
+    waymoctx_key(ctx, keycode, WL_KEYBOARD_KEY_STATE_PRESSED);
+
+    // Clients repeat a held key themselves, waymo only does when asked to
+    uint64_t repeat_interval_ns = param->keyboard_key.interval_ns;
+    if (repeat_interval_ns) {
+      struct pending_action *act = alloc_pending(loop);
       if (act) {
-        act->expiry_ms = timestamp() + repeat_interval_ms;
+        // Repeats stand in for a held key, a late one is better dropped
+        start_periodic(act, timestamp_ns(), 1, repeat_interval_ns, LATE_SKIP);
         act->type = ACTION_KEY_HOLD;
         act->data.key_hold.keycode = keycode;
-        act->data.key_hold.interval_ms = repeat_interval_ms;
-        act->done_fd = fd;
-        schedule_action(loop, act);
+        act->data.key_hold.interval_ns = repeat_interval_ns;
+        // The hold ends with the release of its key so nothing waits on it
+        act->done = (completion){.fd = -1, .batch = NULL};
+        if (schedule_action(loop, act))
+          held->ptr = act;
+        else
+          free_pending(loop, act);
       }
-    } else {
-      // If releasing, signal done immediately
-      signal_done(fd, loop->action_cooldown_ms);
     }
+    // The key state changed, that is all this command promises
+    signal_completion(loop, ctx, done, RESULT_DONE);
   } else {
-    uint32_t hold_ms = param->keyboard_key.keyboard_key_mod.hold_ms;
-    uint32_t repeat_interval_ms =
-        param->keyboard_key.interval_ms ? *param->keyboard_key.interval_ms : 10;
-
-    zwp_virtual_keyboard_v1_key(ctx->kbd, timestamp(), keycode,
-                                WL_KEYBOARD_KEY_STATE_PRESSED);
-    zwp_virtual_keyboard_v1_key(ctx->kbd, timestamp(), keycode,
-                                WL_KEYBOARD_KEY_STATE_RELEASED);
-    wl_display_flush(ctx->display);
-
-    if (hold_ms > repeat_interval_ms) {
-      struct pending_action *act = malloc(sizeof(struct pending_action));
-      act->expiry_ms = timestamp() + repeat_interval_ms;
+    uint64_t hold_ns = param->keyboard_key.keyboard_key_mod.hold_ns;
+    uint64_t repeat_interval_ns = param->keyboard_key.interval_ns;
+
+    waymoctx_key(ctx, keycode, WL_KEYBOARD_KEY_STATE_PRESSED);
+    waymoctx_key(ctx, keycode, WL_KEYBOARD_KEY_STATE_RELEASED);
+
+    // A zero interval would repeat without end within one tick, so like a
+    // hold shorter than the interval it is a single press
+    struct pending_action *act = NULL;
+    if (repeat_interval_ns && hold_ns > repeat_interval_ns)
+      act = alloc_pending(loop);
+    if (act) {
+      start_periodic(act, timestamp_ns(), 1, repeat_interval_ns, LATE_SKIP);
       act->type = ACTION_KEY_REPEAT;
       act->data.key_repeat.keycode = keycode;
-      act->data.key_repeat.repeat_interval_ms = repeat_interval_ms;
-      act->data.key_repeat.total_hold_ms = hold_ms;
-      act->data.key_repeat.elapsed_ms = repeat_interval_ms;
-      act->done_fd = fd;
-      schedule_action(loop, act);
+      act->data.key_repeat.repeat_interval_ns = repeat_interval_ns;
+      act->data.key_repeat.total_hold_ns = hold_ns;
+      act->done = done;
+      if (schedule_action(loop, act)) {
+        waymoctx_pin_key(ctx, keycode);
+      } else {
+        free_pending(loop, act);
+        signal_completion(loop, ctx, done, RESULT_FAILED);
+      }
     } else {
       // If hold time is less than repeat interval, just signal done
-      signal_done(fd, loop->action_cooldown_ms);
+      signal_completion(loop, ctx, done, RESULT_DONE);
     }
   }
 }
 
-void ekbd_type(waymo_event_loop *loop, waymoctx *ctx, command_param *param,
-               int fd) {
-  if (unlikely(!ctx || !param || !ctx->kbd || !param->kbd.txt))
+// xkbcommon gives the real modifiers the same indices in every keymap, Alt and
+// Super are Mod1 and Mod4 as in XKB_MOD_NAME_ALT and XKB_MOD_NAME_LOGO
+static xkb_mod_mask_t kmods_mask(unsigned int kmods) {
+  xkb_mod_mask_t mask = 0;
+  if (kmods & KMOD_SHIFT)
+    mask |= 1u << 0;
+  if (kmods & KMOD_CTRL)
+    mask |= 1u << 2;
+  if (kmods & KMOD_ALT)
+    mask |= 1u << 3;
+  if (kmods & KMOD_SUPER)
+    mask |= 1u << 6;
+  return mask;
+}
+
+void ekbd_shortcut(waymo_event_loop *loop, waymoctx *ctx, command_param *param,
+                   completion done) {
+  if (!ctx->kbd) {
+    signal_completion(loop, ctx, done, RESULT_FAILED);
     return;
+  }
 
-  struct pending_action *act = malloc(sizeof(struct pending_action));
-  if (!act)
+  // The whole chord goes out in this tick and so in one flush
+  uint32_t keycode = waymoctx_get_keycode(ctx, (wchar_t)param->shortcut.key);
+  if (keycode == KEYCODE_NONE) {
+    signal_completion(loop, ctx, done, RESULT_FAILED);
     return;
+  }
+  waymoctx_chord(ctx, keycode, kmods_mask(param->shortcut.mods));
+  signal_completion(loop, ctx, done, RESULT_DONE);
+}
 
-  act->type = ACTION_TYPE_STEP;
-  act->expiry_ms = timestamp(); // Start immediately
-  // Command might be freed after execute_command so dupe string
-  act->data.type_txt.txt = strdup(param->kbd.txt);
-  if (!act->data.type_txt.txt) {
-    free(act);
+void ekbd_type(waymo_event_loop *loop, waymoctx *ctx, command_param *param,
+               completion done) {
+  // The decoded text becomes the action's keycodes, so it is always taken
+  uint32_t *codes = param ? param->kbd.cps : NULL;
+  size_t len = param ? param->kbd.len : 0;
+  if (param)
+    param->kbd.cps = NULL;
+  if (unlikely(!ctx || !ctx->kbd || !codes)) {
+    free(codes);
+    signal_completion(loop, ctx, done, RESULT_FAILED);
+    return;
+  }
+  if (len == 0) {
+    free(codes);
+    signal_completion(loop, ctx, done, RESULT_DONE);
+    return;
+  }
+
+  // Every keycode is known, and any keymap upload sent, before the first key
+  struct pending_action *act = alloc_pending(loop);
+  if (!act || !waymoctx_prepare_text(ctx, codes, len)) {
+    if (act)
+      free_pending(loop, act);
+    free(codes);
+    signal_completion(loop, ctx, done, RESULT_FAILED);
     return;
   }
+
+  act->type = ACTION_TYPE_STEP;
+  // Start immediately, every character must be typed so late ones catch up
+  start_periodic(act, timestamp_ns(), 0, param->kbd.interval_ns,
+                 LATE_CATCH_UP);
+  act->data.type_txt.codes = codes;
+  act->data.type_txt.len = len;
   act->data.type_txt.index = 0;
-  act->data.type_txt.interval_ms =
-      param->kbd.interval_ms ? *param->kbd.interval_ms : 10;
-  act->next = NULL;
+  act->data.type_txt.interval_ns = param->kbd.interval_ns;
 
-  act->done_fd = fd;
+  act->done = done;
 
-  schedule_action(loop, act);
-  wl_display_flush(ctx->display);
+  if (!schedule_action(loop, act)) {
+    waymoctx_unpin_keys(ctx, codes, len);
+    free(act->data.type_txt.codes);
+    free_pending(loop, act);
+    signal_completion(loop, ctx, done, RESULT_FAILED);
+    return;
+  }
 }
@@ -22,10 +22,33 @@ void waymoctx_destroy_pointer(waymoctx *ctx) {
   }
 }
 
+void waymoctx_ptr_frame(waymoctx *ctx) {
+  if (!ctx->frame_open)
+    return;
+  zwlr_virtual_pointer_v1_frame(ctx->ptr);
+  ctx->frame_open = false;
+  ctx->frame_motion = false;
+  ctx->frame_buttons = 0;
+}
+
+void waymoctx_ptr_button(waymoctx *ctx, uint32_t button, uint32_t state) {
+  // A press and release of the same button must not land in one frame
+  uint32_t bit = 1u << ((button - BTN_MOUSE) & 31);
+  if (ctx->frame_buttons & bit)
+    waymoctx_ptr_frame(ctx);
+  zwlr_virtual_pointer_v1_button(ctx->ptr, timestamp(), button, state);
+  ctx->frame_buttons |= bit;
+  ctx->frame_open = true;
+}
+
 void emouse_move(waymoctx *ctx, command_param *param) {
   if (unlikely(!ctx || !ctx->ptr || !param))
     return;
 
+  // Each position of a path has to reach clients, not just the last one
+  if (ctx->frame_motion)
+    waymoctx_ptr_frame(ctx);
+
   if (param->pos.relative) {
     zwlr_virtual_pointer_v1_motion(ctx->ptr, timestamp(),
                                    wl_fixed_from_int(param->pos.x),
@@ -37,11 +60,11 @@ void emouse_move(waymoctx *ctx, command_param *param) {
         ctx->ptr, timestamp(), (uint32_t)param->pos.x, (uint32_t)param->pos.y,
         ctx->screen_width, ctx->screen_height);
   }
-  zwlr_virtual_pointer_v1_frame(ctx->ptr);
-  wl_display_flush(ctx->display);
+  ctx->frame_motion = true;
+  ctx->frame_open = true;
 }
 
-void emouse_btn(waymoctx *ctx, command_param *param) {
+void emouse_btn(waymo_event_loop *loop, waymoctx *ctx, command_param *param) {
   if (unlikely(!ctx || !ctx->ptr || !param))
     return;
 
@@ -52,35 +75,47 @@ void emouse_btn(waymoctx *ctx, command_param *param) {
   uint32_t state = param->mouse_btn.down ? WL_POINTER_BUTTON_STATE_PRESSED
                                          : WL_POINTER_BUTTON_STATE_RELEASED;
 
-  zwlr_virtual_pointer_v1_button(ctx->ptr, timestamp(), button, state);
-  zwlr_virtual_pointer_v1_frame(ctx->ptr);
-  wl_display_flush(ctx->display);
+  waymoctx_ptr_button(ctx, button, state);
+  // Remembered so a cancel or shutdown can let go of it
+  uint8_t bit = 1u << (button - BTN_MOUSE);
+  if (param->mouse_btn.down)
+    loop->held_buttons |= bit;
+  else
+    loop->held_buttons &= ~bit;
 }
 
 void emouse_click(waymo_event_loop *loop, waymoctx *ctx, command_param *param,
-                  int fd) {
-  if (unlikely(!ctx || !ctx->ptr || !param))
-    return;
-
+                  completion done) {
   uint32_t button = mbtnstoliec(param->mouse_click.button);
-  if (button == 0)
+  if (unlikely(!ctx->ptr || button == 0)) {
+    signal_completion(loop, ctx, done, RESULT_FAILED);
     return;
+  }
+  if (param->mouse_click.clicks == 0) {
+    signal_completion(loop, ctx, done, RESULT_DONE);
+    return;
+  }
 
-  zwlr_virtual_pointer_v1_button(ctx->ptr, timestamp(), button,
-                                 WL_POINTER_BUTTON_STATE_PRESSED);
-  zwlr_virtual_pointer_v1_frame(ctx->ptr);
-  wl_display_flush(ctx->display);
+  waymoctx_ptr_button(ctx, button, WL_POINTER_BUTTON_STATE_PRESSED);
 
   // Schedule the release and other clicks
-  struct pending_action *act = malloc(sizeof(struct pending_action));
-  if (!act)
-    return;
-  act->done_fd = fd;
-  act->expiry_ms = timestamp() + param->mouse_click.click_ms;
-  act->type = ACTION_CLICK_STEP;
-  act->data.click.button = button;
-  act->data.click.ms = param->mouse_click.click_ms;
-  act->data.click.remaining = param->mouse_click.clicks;
-  act->data.click.is_down = true; // We are currently down, next step is up
-  schedule_action(loop, act);
+  struct pending_action *act = alloc_pending(loop);
+  if (act) {
+    act->done = done;
+    // The press above is tick 0 and every click has to happen
+    start_periodic(act, timestamp_ns(), 1, param->mouse_click.click_ns,
+                   LATE_CATCH_UP);
+    act->type = ACTION_CLICK_STEP;
+    act->data.click.button = button;
+    act->data.click.ns = param->mouse_click.click_ns;
+    act->data.click.remaining = param->mouse_click.clicks;
+    act->data.click.is_down = true; // We are currently down, next step is up
+    if (schedule_action(loop, act))
+      return;
+    free_pending(loop, act);
+  }
+
+  // Do not leave the button stuck down
+  waymoctx_ptr_button(ctx, button, WL_POINTER_BUTTON_STATE_RELEASED);
+  signal_completion(loop, ctx, done, RESULT_FAILED);
 }
@@ -1,9 +1,12 @@
 #include "wayland/waycon.h"
 #include "events/event_loop.h"
+#include <errno.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <wayland-client-core.h>
 
-waymoctx *init_waymoctx(char *layout, _Atomic loop_status *status) {
+waymoctx *init_waymoctx(waymo_event_loop *loop) {
+  _Atomic loop_status *status = &loop->status;
   waymoctx *ctx = calloc(1, sizeof(waymoctx));
   if (!ctx) {
     atomic_fetch_or(status, STATUS_INIT_FAILED);
@@ -12,7 +15,8 @@ waymoctx *init_waymoctx(char *layout, _Atomic loop_status *status) {
   if (!waymoctx_connect(ctx, status)) {
     goto err_cleanup;
   }
-  if (!waymoctx_kbd(ctx, layout))
+  ctx->loop = loop;
+  if (!waymoctx_kbd(ctx, loop->kbd_layout))
     atomic_fetch_or(status, STATUS_KBD_FAILED);
   if (!waymoctx_pointer(ctx))
     atomic_fetch_or(status, STATUS_PTR_FAILED);
@@ -25,6 +29,25 @@ err_cleanup:
   return NULL;
 }
 
+bool waymoctx_flush(waymoctx *ctx) {
+  // Requests go out in order on the one socket, so once they are written the
+  // compositor sees them before anything sent later and no reply is needed
+  while (wl_display_flush(ctx->display) < 0) {
+    if (errno != EAGAIN)
+      return false;
+    struct pollfd pfd = {.fd = wl_display_get_fd(ctx->display),
+                         .events = POLLOUT};
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+      return false;
+  }
+  return true;
+}
+
+bool waymoctx_commit(waymoctx *ctx) {
+  waymoctx_ptr_frame(ctx);
+  return waymoctx_flush(ctx);
+}
+
 void destroy_waymoctx(waymoctx *ctx) {
   if (!ctx)
     return;
@@ -0,0 +1,416 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include "events/commands.h"
+#include "events/event_loop.h"
+#include "wayland/waycon.h"
+#include "fixtures.h"
+
+static void test_batch_keeps_order(void **state) {
+    command *batch = _create_batch_cmd();
+    assert_non_null(batch);
+    assert_int_equal(batch->type, CMD_BATCH);
+
+    // Enough entries to force the command list to grow a few times
+    for (unsigned int i = 0; i < 100; i++)
+        assert_true(_batch_append(batch, _create_mouse_move_cmd(NULL, i, i, false)));
+
+    assert_int_equal(batch->param.batch.len, 100);
+    for (unsigned int i = 0; i < 100; i++) {
+        command *c = batch->param.batch.cmds[i];
+        assert_int_equal(c->type, CMD_MOUSE_MOVE);
+        assert_int_equal(c->param.pos.x, i);
+    }
+
+    _discard_command(batch);
+}
+
+static void test_batch_append_rejects(void **state) {
+    // Appending to something that is not a batch frees the command
+    command *move = _create_mouse_move_cmd(NULL, 1, 1, false);
+    assert_false(_batch_append(move, _create_mouse_move_cmd(NULL, 2, 2, false)));
+    assert_false(_batch_append(NULL, _create_mouse_move_cmd(NULL, 3, 3, false)));
+
+    command *batch = _create_batch_cmd();
+    assert_false(_batch_append(batch, NULL));
+    assert_int_equal(batch->param.batch.len, 0);
+
+    _discard_command(move);
+    _discard_command(batch);
+}
+
+static void test_intervals_copied(void **state) {
+    uint32_t interval = 25;
+    command *type = _create_keyboard_type_cmd(NULL, "abc", &interval);
+    command *key = _create_keyboard_key_cmd_b(NULL, 'a', NULL, true);
+    interval = 0;
+
+    // The command must not see later changes to the caller's variable
+    assert_int_equal(type->param.kbd.interval_ns, 25000000);
+    // A held key is repeated by the client unless asked otherwise
+    assert_int_equal(key->param.keyboard_key.interval_ns, 0);
+
+    _discard_command(type);
+    _discard_command(key);
+}
+
+static void test_text_decoded_on_create(void **state) {
+    command *type = _create_keyboard_type_cmd(NULL, "h\xc3\xa9!", NULL);
+    command *key = _create_keyboard_codepoint_cmd_b(NULL, 0x1f600, NULL, true);
+    command *byte = _create_keyboard_key_cmd_b(NULL, (char)0xe9, NULL, true);
+
+    assert_int_equal(type->param.kbd.len, 3);
+    assert_int_equal(type->param.kbd.cps[1], 0xe9);
+    assert_int_equal(key->param.keyboard_key.key, 0x1f600);
+    // A single byte is never sign extended into a huge code point
+    assert_int_equal(byte->param.keyboard_key.key, 0xe9);
+
+    _discard_command(type);
+    _discard_command(key);
+    _discard_command(byte);
+}
+
+static void test_shortcut_chord(void **state) {
+    command *cmd = _create_keyboard_shortcut_cmd(NULL, KMOD_CTRL | KMOD_SHIFT,
+                                                 'c');
+    assert_int_equal(cmd->type, CMD_KEYBOARD_SHORTCUT);
+    assert_int_equal(cmd->param.shortcut.key, 'c');
+    assert_int_equal(cmd->param.shortcut.mods, KMOD_CTRL | KMOD_SHIFT);
+    _discard_command(cmd);
+
+    // Staged behind an unconfirmed keymap the chord can be looked at whole
+    staged_fixture f;
+    staged_fixture_init(&f);
+    waymoctx *ctx = &f.ctx;
+    waymoctx_chord(ctx, KEY_PACK(46, 0), 1u << 2);
+    assert_int_equal(ctx->staged_len, 2);
+    assert_int_equal(ctx->staged[0].state, WL_KEYBOARD_KEY_STATE_PRESSED);
+    assert_int_equal(ctx->staged[1].state, WL_KEYBOARD_KEY_STATE_RELEASED);
+    assert_int_equal(ctx->staged[0].mods, 1u << 2);
+    assert_int_equal(ctx->staged[1].mods, 1u << 2);
+    // Nothing has reached the compositor so no modifiers are held yet
+    assert_int_equal(ctx->mods, 0);
+    staged_fixture_clear(&f);
+}
+
+static void test_us_intervals_kept(void **state) {
+    uint32_t interval = 250;
+    command *type = _create_keyboard_type_cmd_us(NULL, "abc", &interval);
+    command *hold = _create_keyboard_key_cmd_uintt_us(NULL, 'a', &interval, 1500);
+    command *click = _create_mouse_click_cmd_us(NULL, MBTN_LEFT, 1, 800);
+
+    // Sub millisecond durations survive instead of rounding to zero
+    assert_int_equal(type->param.kbd.interval_ns, 250000);
+    assert_int_equal(hold->param.keyboard_key.interval_ns, 250000);
+    assert_int_equal(hold->param.keyboard_key.keyboard_key_mod.hold_ns,
+                     1500000);
+    assert_int_equal(click->param.mouse_click.click_ns, 800000);
+
+    _discard_command(type);
+    _discard_command(hold);
+    _discard_command(click);
+}
+
+static void *other_thread_fd(void *arg) {
+    int *out = arg;
+    out[0] = _thread_done_fd();
+    out[1] = _thread_done_fd();
+    return NULL;
+}
+
+static void test_thread_done_fd_reused(void **state) {
+    int fd = _thread_done_fd();
+    assert_true(fd >= 0);
+    assert_int_equal(_thread_done_fd(), fd);
+
+    int other[2];
+    pthread_t t;
+    pthread_create(&t, NULL, other_thread_fd, other);
+    pthread_join(t, NULL);
+
+    // Each thread gets its own fd and gives it back when it exits
+    assert_true(other[0] >= 0);
+    assert_int_equal(other[0], other[1]);
+    assert_int_not_equal(other[0], fd);
+    assert_int_equal(fcntl(other[0], F_GETFD), -1);
+}
+
+typedef struct {
+    int calls;
+    action_ticket ticket;
+    action_result result;
+} async_seen;
+
+static void record_done(action_ticket ticket, action_result result,
+                        void *user_data) {
+    async_seen *seen = user_data;
+    seen->calls++;
+    seen->ticket = ticket;
+    seen->result = result;
+}
+
+static void test_async_callback(void **state) {
+    waymo_event_loop loop = {0};
+    loop.queue = create_queue(2);
+    atomic_init(&loop.next_ticket, 1);
+    async_seen seen = {0};
+
+    action_ticket a = _send_command_async(
+        &loop, _create_mouse_move_cmd(NULL, 1, 2, false), record_done, &seen);
+    action_ticket b = _send_command_async(
+        &loop, _create_mouse_move_cmd(NULL, 3, 4, false), record_done, &seen);
+    assert_int_not_equal(a, 0);
+    assert_int_not_equal(a, b);
+
+    // A full queue refuses the action and never calls back
+    assert_int_equal(
+        _send_command_async(&loop, _create_mouse_move_cmd(NULL, 5, 6, false),
+                            record_done, &seen),
+        0);
+    assert_int_equal(
+        _send_command_async(NULL, _create_mouse_move_cmd(NULL, 5, 6, false),
+                            record_done, &seen),
+        0);
+
+    // Completing a queued command reports its own ticket
+    command *cmd = remove_queue(loop.queue);
+    signal_completion(&loop, NULL, cmd->done, RESULT_FAILED);
+    assert_int_equal(seen.calls, 1);
+    assert_int_equal(seen.ticket, a);
+    assert_int_equal(seen.result, RESULT_FAILED);
+    free_command(cmd);
+
+    destroy_queue(loop.queue);
+    assert_int_equal(seen.calls, 1);
+}
+
+static void test_completions_wait_for_staged_keys(void **state) {
+    staged_fixture f;
+    staged_fixture_init(&f);
+    waymo_event_loop *loop = &f.loop;
+    waymoctx *ctx = &f.ctx;
+    async_seen before = {0}, after = {0};
+
+    signal_completion(loop, ctx,
+                      (completion){.fd = -1, .cb = record_done,
+                                   .user_data = &before, .ticket = 1},
+                      RESULT_DONE);
+    waymoctx_key(ctx, KEY_PACK(30, 0), WL_KEYBOARD_KEY_STATE_PRESSED);
+    signal_completion(loop, ctx,
+                      (completion){.fd = -1, .cb = record_done,
+                                   .user_data = &after, .ticket = 2},
+                      RESULT_DONE);
+
+    // Only the action that finished after the key was staged has to wait
+    deliver_finished(loop, ctx, true);
+    assert_int_equal(before.calls, 1);
+    assert_int_equal(after.calls, 0);
+    assert_int_equal(loop->finished_len, 1);
+
+    // As if the keymap was confirmed and the key sent
+    ctx->staged_len = 0;
+    ctx->unstaged_seq = ctx->staged_seq;
+    deliver_finished(loop, ctx, true);
+    assert_int_equal(after.calls, 1);
+    assert_int_equal(after.result, RESULT_DONE);
+    assert_int_equal(loop->finished_len, 0);
+
+    // A tick that never reached the compositor fails whatever is held
+    waymoctx_key(ctx, KEY_PACK(30, 0), WL_KEYBOARD_KEY_STATE_RELEASED);
+    signal_completion(loop, ctx,
+                      (completion){.fd = -1, .cb = record_done,
+                                   .user_data = &after, .ticket = 3},
+                      RESULT_DONE);
+    deliver_finished(loop, ctx, false);
+    assert_int_equal(after.calls, 2);
+    assert_int_equal(after.result, RESULT_FAILED);
+
+    staged_fixture_clear(&f);
+}
+
+static void test_batch_waits_for_staged_keys(void **state) {
+    wire_fixture f;
+    wire_fixture_init(&f);
+    waymoctx *ctx = f.ctx;
+    uint32_t kbd = wire_id(ctx->kbd), ptr = wire_id(ctx->ptr);
+    async_seen seen = {0};
+
+    uint32_t zero = 0;
+    command *batch = _create_batch_cmd();
+    _batch_append(batch, _create_keyboard_type_cmd(NULL, "\xc3\xa9", &zero));
+    _batch_append(batch, _create_mouse_click_cmd(NULL, MBTN_LEFT, 1, 0));
+    batch->done = (completion){
+        .fd = -1, .cb = record_done, .user_data = &seen, .ticket = 1};
+    execute_command(&f.loop, ctx, batch);
+    free_command(batch);
+
+    // The upload for \xc3\xa9 is unconfirmed so its keys are staged, and the
+    // click must not overtake them
+    handle_timer_expiry(&f.loop, ctx);
+    flush_tick(&f.loop, ctx);
+    wire_fixture_read(&f);
+    assert_int_equal(wire_count(&f, kbd, ZWP_VIRTUAL_KEYBOARD_V1_KEYMAP), 1);
+    assert_int_equal(wire_count(&f, kbd, ZWP_VIRTUAL_KEYBOARD_V1_KEY), 0);
+    assert_int_equal(wire_count(&f, ptr, ZWLR_VIRTUAL_POINTER_V1_BUTTON), 0);
+
+    // Once the keymap is confirmed the keys go out and only then the press
+    wire_fixture_confirm(&f);
+    flush_tick(&f.loop, ctx);
+    wire_fixture_read(&f);
+    assert_int_equal(wire_count(&f, kbd, ZWP_VIRTUAL_KEYBOARD_V1_KEY), 2);
+    assert_int_equal(wire_count(&f, ptr, ZWLR_VIRTUAL_POINTER_V1_BUTTON), 1);
+    assert_true(wire_first(&f, ptr, ZWLR_VIRTUAL_POINTER_V1_BUTTON) >
+                wire_first(&f, kbd, ZWP_VIRTUAL_KEYBOARD_V1_KEY) + 1);
+    assert_int_equal(seen.calls, 0);
+
+    // The release finishes the click and with it the batch
+    handle_timer_expiry(&f.loop, ctx);
+    flush_tick(&f.loop, ctx);
+    assert_int_equal(seen.calls, 1);
+    assert_int_equal(seen.result, RESULT_DONE);
+
+    wire_fixture_clear(&f);
+}
+
+// Opcodes of the requests read so far that went to object, in order
+static size_t wire_opcodes(const wire_fixture *f, uint32_t object,
+                           uint32_t *ops, size_t max) {
+    size_t n = 0;
+    for (size_t i = 0; i < f->len && n < max; i++)
+        if (f->reqs[i].object == object)
+            ops[n++] = f->reqs[i].opcode;
+    return n;
+}
+
+static void run_and_free(wire_fixture *f, command *cmd) {
+    cmd->done = (completion){.fd = -1};
+    execute_command(&f->loop, f->ctx, cmd);
+    free_command(cmd);
+}
+
+static void test_button_frames(void **state) {
+    wire_fixture f;
+    wire_fixture_init(&f);
+    uint32_t ptr = wire_id(f.ctx->ptr);
+
+    // Different buttons share a frame, a release of one already pressed in
+    // it starts the next
+    run_and_free(&f, _create_mouse_button_cmd(NULL, MBTN_LEFT, true));
+    run_and_free(&f, _create_mouse_button_cmd(NULL, MBTN_RIGHT, true));
+    run_and_free(&f, _create_mouse_button_cmd(NULL, MBTN_LEFT, false));
+    run_and_free(&f, _create_mouse_button_cmd(NULL, MBTN_RIGHT, false));
+    flush_tick(&f.loop, f.ctx);
+    wire_fixture_read(&f);
+
+    const uint32_t want[] = {
+        ZWLR_VIRTUAL_POINTER_V1_BUTTON, ZWLR_VIRTUAL_POINTER_V1_BUTTON,
+        ZWLR_VIRTUAL_POINTER_V1_FRAME,  ZWLR_VIRTUAL_POINTER_V1_BUTTON,
+        ZWLR_VIRTUAL_POINTER_V1_BUTTON, ZWLR_VIRTUAL_POINTER_V1_FRAME};
+    uint32_t ops[16];
+    assert_int_equal(wire_opcodes(&f, ptr, ops, 16), 6);
+    assert_memory_equal(ops, want, sizeof(want));
+    assert_int_equal(f.loop.held_buttons, 0);
+
+    wire_fixture_clear(&f);
+}
+
+static void test_motion_frames(void **state) {
+    wire_fixture f;
+    wire_fixture_init(&f);
+    uint32_t ptr = wire_id(f.ctx->ptr);
+
+    // A button joins the motion before it but every motion opens a frame
+    run_and_free(&f, _create_mouse_move_cmd(NULL, 1, 1, true));
+    run_and_free(&f, _create_mouse_button_cmd(NULL, MBTN_LEFT, true));
+    run_and_free(&f, _create_mouse_move_cmd(NULL, 2, 2, true));
+    run_and_free(&f, _create_mouse_move_cmd(NULL, 3, 3, true));
+    flush_tick(&f.loop, f.ctx);
+    wire_fixture_read(&f);
+
+    const uint32_t want[] = {
+        ZWLR_VIRTUAL_POINTER_V1_MOTION, ZWLR_VIRTUAL_POINTER_V1_BUTTON,
+        ZWLR_VIRTUAL_POINTER_V1_FRAME,  ZWLR_VIRTUAL_POINTER_V1_MOTION,
+        ZWLR_VIRTUAL_POINTER_V1_FRAME,  ZWLR_VIRTUAL_POINTER_V1_MOTION,
+        ZWLR_VIRTUAL_POINTER_V1_FRAME};
+    uint32_t ops[16];
+    assert_int_equal(wire_opcodes(&f, ptr, ops, 16), 7);
+    assert_memory_equal(ops, want, sizeof(want));
+
+    release_held_buttons(&f.loop, f.ctx);
+    wire_fixture_clear(&f);
+}
+
+static void test_zero_interval_hold(void **state) {
+    wire_fixture f;
+    wire_fixture_init(&f);
+    waymoctx *ctx = f.ctx;
+    uint32_t kbd = wire_id(ctx->kbd);
+    async_seen seen = {0};
+
+    // Nothing would move the repeats on, so the hold is one press
+    uint32_t zero = 0;
+    command *hold = _create_keyboard_key_cmd_uintt(NULL, 'a', &zero, 100);
+    hold->done = (completion){
+        .fd = -1, .cb = record_done, .user_data = &seen, .ticket = 1};
+    execute_command(&f.loop, ctx, hold);
+    free_command(hold);
+    assert_int_equal(f.loop.pending_len, 0);
+
+    flush_tick(&f.loop, ctx);
+    wire_fixture_read(&f);
+    assert_int_equal(wire_count(&f, kbd, ZWP_VIRTUAL_KEYBOARD_V1_KEY), 2);
+    assert_int_equal(seen.calls, 1);
+    assert_int_equal(seen.result, RESULT_DONE);
+
+    wire_fixture_clear(&f);
+}
+
+static void test_held_batch_cancelled(void **state) {
+    staged_fixture f;
+    staged_fixture_init(&f);
+    async_seen seen = {0};
+
+    // A step that left a key staged holds its batch
+    command *batch = _create_batch_cmd();
+    _batch_append(batch, _create_mouse_move_cmd(NULL, 1, 1, false));
+    batch->done = (completion){
+        .fd = -1, .cb = record_done, .user_data = &seen, .ticket = 7};
+    waymoctx_key(&f.ctx, KEY_PACK(30, 0), WL_KEYBOARD_KEY_STATE_PRESSED);
+    execute_command(&f.loop, &f.ctx, batch);
+    free_command(batch);
+    assert_non_null(f.loop.held_batches);
+
+    // Its ticket finds it even though no action of it is pending
+    assert_false(cancel_actions(&f.loop, &f.ctx, 8));
+    assert_true(cancel_actions(&f.loop, &f.ctx, 7));
+    assert_null(f.loop.held_batches);
+    deliver_finished(&f.loop, &f.ctx, false);
+    assert_int_equal(seen.calls, 1);
+    assert_int_equal(seen.ticket, 7);
+
+    staged_fixture_clear(&f);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_batch_keeps_order),
+        cmocka_unit_test(test_batch_append_rejects),
+        cmocka_unit_test(test_intervals_copied),
+        cmocka_unit_test(test_text_decoded_on_create),
+        cmocka_unit_test(test_shortcut_chord),
+        cmocka_unit_test(test_us_intervals_kept),
+        cmocka_unit_test(test_thread_done_fd_reused),
+        cmocka_unit_test(test_async_callback),
+        cmocka_unit_test(test_completions_wait_for_staged_keys),
+        cmocka_unit_test(test_batch_waits_for_staged_keys),
+        cmocka_unit_test(test_button_frames),
+        cmocka_unit_test(test_motion_frames),
+        cmocka_unit_test(test_zero_interval_hold),
+        cmocka_unit_test(test_held_batch_cancelled),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,185 @@
+#ifndef WAYMO_TEST_FIXTURES_H
+#define WAYMO_TEST_FIXTURES_H
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "events/pendings.h"
+
+// A loop and context with no compositor behind them. Keys stay staged as if a
+// keymap upload were unconfirmed, so tests can look at what an action would
+// send without anything being sent
+typedef struct {
+    waymo_event_loop loop;
+    waymoctx ctx;
+} staged_fixture;
+
+static inline void staged_fixture_init(staged_fixture *f) {
+    memset(f, 0, sizeof(*f));
+    pthread_mutex_init(&f->loop.pending_mutex, NULL);
+    f->ctx.loop = &f->loop;
+    f->ctx.keymap_sync = (struct wl_callback *)&f->ctx;
+}
+
+static inline void staged_fixture_clear(staged_fixture *f) {
+    cancel_held_batches(&f->loop, &f->ctx, 0);
+    free(f->ctx.staged);
+    free(f->ctx.down);
+    free(f->ctx.keymap);
+    keycode_index_clear(&f->ctx.keycodes);
+    free(f->loop.finished);
+    u64_map_clear(&f->loop.held);
+    clear_pending_actions(&f->loop);
+    pthread_mutex_destroy(&f->loop.pending_mutex);
+}
+
+// A heap allocated action that tells no one when it is done, free_pending and
+// clear_pending_actions take it like one from the pool
+static inline struct pending_action *fixture_action(enum action_type type,
+                                                    uint64_t expiry_ns,
+                                                    action_ticket ticket) {
+    struct pending_action *act = calloc(1, sizeof(struct pending_action));
+    act->type = type;
+    act->expiry_ns = expiry_ns;
+    act->done = (completion){.fd = -1, .ticket = ticket};
+    return act;
+}
+
+#define WIRE_MAX_REQUESTS 1024
+#define WIRE_DISPLAY_ID 1
+
+// A virtual keyboard and pointer on a real connection whose compositor end
+// the test reads itself, so it can check which requests an action sent and
+// in what order. Keymap uploads stay unconfirmed until wire_fixture_confirm
+typedef struct {
+    waymo_event_loop loop;
+    waymoctx *ctx;
+    int fd; // Compositor end
+    struct wire_request {
+        uint32_t object;
+        uint32_t opcode;
+        uint32_t arg; // First argument, 0 if there is none
+    } reqs[WIRE_MAX_REQUESTS];
+    size_t len;
+    uint32_t syncs[16]; // Callbacks of wl_display.sync not answered yet
+    size_t syncs_len;
+} wire_fixture;
+
+static inline uint32_t wire_id(void *proxy) {
+    return wl_proxy_get_id((struct wl_proxy *)proxy);
+}
+
+// Flushes the connection and records every request sent since the last read
+static inline void wire_fixture_read(wire_fixture *f) {
+    waymoctx_flush(f->ctx);
+    uint32_t buf[4096];
+    size_t len = 0;
+    ssize_t n;
+    while ((n = recv(f->fd, (char *)buf + len, sizeof(buf) - len,
+                     MSG_DONTWAIT)) > 0) {
+        len += n;
+        size_t off = 0;
+        while (len - off >= 8) {
+            uint32_t *msg = (uint32_t *)((char *)buf + off);
+            uint32_t size = msg[1] >> 16;
+            uint32_t opcode = msg[1] & 0xffff;
+            if (size < 8 || len - off < size)
+                break;
+            if (msg[0] == WIRE_DISPLAY_ID && opcode == WL_DISPLAY_SYNC &&
+                f->syncs_len < 16)
+                f->syncs[f->syncs_len++] = msg[2];
+            if (f->len < WIRE_MAX_REQUESTS)
+                f->reqs[f->len++] = (struct wire_request){
+                    .object = msg[0],
+                    .opcode = opcode,
+                    .arg = size > 8 ? msg[2] : 0};
+            off += size;
+        }
+        // Whatever is left is the start of a message the next read finishes
+        memmove(buf, (char *)buf + off, len - off);
+        len -= off;
+    }
+}
+
+// Requests sent to object with opcode among those read so far
+static inline size_t wire_count(const wire_fixture *f, uint32_t object,
+                                uint32_t opcode) {
+    size_t n = 0;
+    for (size_t i = 0; i < f->len; i++)
+        n += f->reqs[i].object == object && f->reqs[i].opcode == opcode;
+    return n;
+}
+
+// Position of the first such request read so far, or len if there is none
+static inline size_t wire_first(const wire_fixture *f, uint32_t object,
+                                uint32_t opcode) {
+    size_t i = 0;
+    while (i < f->len &&
+           (f->reqs[i].object != object || f->reqs[i].opcode != opcode))
+        i++;
+    return i;
+}
+
+static inline void wire_reply(int fd, uint32_t object, uint32_t opcode,
+                              uint32_t arg) {
+    uint32_t msg[3] = {object, (12u << 16) | opcode, arg};
+    ssize_t ignored = write(fd, msg, sizeof(msg));
+    (void)ignored;
+}
+
+// Answers every sync read so far, as a compositor would once it has handled
+// the keymap sent before it, and lets the keyboard send what it staged
+static inline void wire_fixture_confirm(wire_fixture *f) {
+    wire_fixture_read(f);
+    for (size_t i = 0; i < f->syncs_len; i++) {
+        wire_reply(f->fd, f->syncs[i], 0, 0);               // wl_callback.done
+        wire_reply(f->fd, WIRE_DISPLAY_ID, 1, f->syncs[i]); // delete_id
+    }
+    f->syncs_len = 0;
+    if (f->ctx->keymap_sync)
+        wl_display_dispatch_queue(f->ctx->display, f->ctx->kbd_queue);
+}
+
+static inline void wire_fixture_init(wire_fixture *f) {
+    memset(f, 0, sizeof(*f));
+    pthread_mutex_init(&f->loop.pending_mutex, NULL);
+    f->loop.timer_fd = -1;
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+    f->fd = fds[1];
+
+    // Globals are bound by made up names, nobody checks them
+    waymoctx *ctx = calloc(1, sizeof(waymoctx));
+    ctx->loop = &f->loop;
+    ctx->display = wl_display_connect_to_fd(fds[0]);
+    ctx->registry = wl_display_get_registry(ctx->display);
+    ctx->seat = wl_registry_bind(ctx->registry, 1, &wl_seat_interface, 1);
+    ctx->kman = wl_registry_bind(ctx->registry, 2,
+                                 &zwp_virtual_keyboard_manager_v1_interface, 1);
+    ctx->pman = wl_registry_bind(ctx->registry, 3,
+                                 &zwlr_virtual_pointer_manager_v1_interface, 2);
+    waymoctx_kbd(ctx, NULL);
+    waymoctx_pointer(ctx);
+    f->ctx = ctx;
+
+    // Tests only look at what their actions send
+    wire_fixture_confirm(f);
+    wire_fixture_read(f);
+    f->len = 0;
+}
+
+static inline void wire_fixture_clear(wire_fixture *f) {
+    cancel_held_batches(&f->loop, f->ctx, 0);
+    clear_pending_actions(&f->loop);
+    free(f->loop.finished);
+    u64_map_clear(&f->loop.held);
+    // Closes the client end too
+    destroy_waymoctx(f->ctx);
+    close(f->fd);
+    pthread_mutex_destroy(&f->loop.pending_mutex);
+}
+
+#endif
@@ -0,0 +1,361 @@
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "wayland/keymap.h"
+#include "wayland/waycon.h"
+#include "fixtures.h"
+
+static struct keymap_entry *make_keymap(size_t len) {
+    struct keymap_entry *keymap = malloc(len * sizeof(struct keymap_entry));
+    for (size_t i = 0; i < len; i++) {
+        keymap[i].wchr = (wchar_t)(0x100 + i);
+        keymap[i].xkb = xkb_utf32_to_keysym((uint32_t)keymap[i].wchr);
+    }
+    return keymap;
+}
+
+static void test_keymap_text(void **state) {
+    struct keymap_entry *keymap = make_keymap(12);
+    char *buf = malloc(keymap_text_size(NULL, 12) + 1);
+    size_t len = keymap_text(NULL, keymap, 12, buf);
+    buf[len] = '\0';
+
+    assert_true(len <= keymap_text_size(NULL, 12));
+    assert_non_null(strstr(buf, "  maximum = 20;\n"));
+    assert_non_null(strstr(buf, "  <K0> = 8;\n"));
+    assert_non_null(strstr(buf, "  <K11> = 19;\n"));
+    assert_non_null(strstr(buf, "  key <K11> {[ "));
+    assert_int_equal(strcmp(buf + len - 6, "};\n};\n"), 0);
+
+    free(buf);
+    free(keymap);
+}
+
+// Trimmed down output of xkb_keymap_get_as_string
+static const char layout_text[] =
+    "xkb_keymap {\n"
+    "xkb_keycodes \"evdev+aliases(qwerty)\" {\n"
+    "\tminimum = 8;\n"
+    "\tmaximum = 255;\n"
+    "\t<AC01>               = 38;\n"
+    "\tindicator 1 = \"Caps Lock\";\n"
+    "};\n\n"
+    "xkb_types \"complete\" {\n"
+    "\tvirtual_modifiers NumLock;\n"
+    "};\n\n"
+    "xkb_symbols \"pc+us+inet(evdev)\" {\n"
+    "\tkey <AC01>               {\t[               a,               A ] };\n"
+    "\tmodifier_map Shift { <LFSH> };\n"
+    "};\n\n"
+    "};\n";
+
+static void test_keymap_layout_splice(void **state) {
+    struct keymap_layout layout;
+    char *broken = strdup("xkb_keymap {\n};\n");
+    assert_false(keymap_layout_init(&layout, broken, 255));
+    assert_true(keymap_layout_init(&layout, strdup(layout_text), 255));
+    assert_int_equal(layout.first, 256);
+    // Every keycode in range but the one <AC01> names is free to use
+    assert_int_equal(layout.spare_len, 247);
+    assert_int_equal(layout.spare[0], 8);
+    assert_int_equal(layout.spare[30], 39);
+    assert_int_equal(layout.spare_slot[38], 0);
+    assert_int_equal(layout.spare_slot[39], 31);
+
+    // Without dynamic keys the layout goes out untouched
+    char *buf = malloc(keymap_text_size(&layout, 2) + 1);
+    size_t len = keymap_text(&layout, NULL, 0, buf);
+    buf[len] = '\0';
+    assert_string_equal(buf, layout_text);
+
+    struct keymap_entry *keymap = make_keymap(2);
+    len = keymap_text(&layout, keymap, 2, buf);
+    buf[len] = '\0';
+    assert_true(len <= keymap_text_size(&layout, 2));
+    // Spare keycodes leave the maximum alone
+    assert_non_null(strstr(buf, "\tmaximum = 255;\n"));
+    assert_non_null(strstr(buf, "  <K0> = 8;\n"));
+
+    // Keycodes go at the end of xkb_keycodes, symbols at the end of
+    // xkb_symbols and the rest is kept as it was
+    char *code = strstr(buf, "  <K1> = 9;\n");
+    char *types = strstr(buf, "xkb_types");
+    char *sym = strstr(buf, "  key <K1> {[ ");
+    assert_non_null(code);
+    assert_non_null(sym);
+    assert_true(strstr(buf, "Caps Lock") < code && code < types);
+    assert_true(strstr(buf, "modifier_map") < sym);
+    assert_string_equal(buf + len - 12, " ]};\n};\n\n};\n");
+
+    free(keymap);
+    free(buf);
+    keymap_layout_clear(&layout);
+}
+
+static void test_keymap_layout_spare_used_up(void **state) {
+    static const char small[] =
+        "xkb_keymap {\n"
+        "xkb_keycodes \"small\" {\n"
+        "\tminimum = 8;\n"
+        "\tmaximum = 10;\n"
+        "\t<AC01>               = 8;\n"
+        "\t<AC02>               = 10;\n"
+        "\talias <AC03>         = <AC01>;\n"
+        "\tindicator 9 = \"Caps Lock\";\n"
+        "};\n\n"
+        "xkb_types \"complete\" {\n"
+        "};\n\n"
+        "xkb_symbols \"small\" {\n"
+        "};\n\n"
+        "};\n";
+    struct keymap_layout layout;
+    assert_true(keymap_layout_init(&layout, strdup(small), 10));
+    assert_int_equal(layout.spare_len, 1);
+    assert_int_equal(layout.spare[0], 9);
+
+    // Only once the spare keycode is taken do keys go past the maximum
+    struct keymap_entry *keymap = make_keymap(3);
+    char *buf = malloc(keymap_text_size(&layout, 3) + 1);
+    size_t len = keymap_text(&layout, keymap, 3, buf);
+    buf[len] = '\0';
+    assert_non_null(strstr(buf, "\tmaximum = 12;\n"));
+    assert_non_null(strstr(buf, "  <K0> = 9;\n"));
+    assert_non_null(strstr(buf, "  <K1> = 11;\n"));
+    assert_non_null(strstr(buf, "  <K2> = 12;\n"));
+    free(keymap);
+    free(buf);
+
+    // Keys as sent are evdev codes, 8 below their XKB keycodes
+    waymoctx ctx = {0};
+    ctx.layout = layout;
+    ctx.keymap_first = layout.first - 8;
+    assert_int_equal(waymoctx_get_keycode(&ctx, 0x3b1), 1);
+    assert_int_equal(waymoctx_get_keycode(&ctx, 0x3b2), 3);
+    waymoctx_pin_key(&ctx, 1);
+    waymoctx_pin_key(&ctx, 3);
+    // Layout keys have no entry to pin
+    waymoctx_pin_key(&ctx, 2);
+    assert_int_equal(ctx.keymap[0].pins, 1);
+    assert_int_equal(ctx.keymap[1].pins, 1);
+
+    free(ctx.keymap);
+    keycode_index_clear(&ctx.keycodes);
+    keymap_layout_clear(&ctx.layout);
+}
+
+static void test_keymap_cache(void **state) {
+    char dir[] = "/tmp/waymo-cache-XXXXXX";
+    assert_non_null(mkdtemp(dir));
+    setenv("XDG_CACHE_HOME", dir, 1);
+
+    struct keymap_layout layout, loaded;
+    xkb_mod_mask_t mods[KEY_MODS_MAX] = {0, 1};
+    unsigned int mods_len = 0;
+    struct layout_key keys[] = {{'a', KEY_PACK(30, 0)}, {'A', KEY_PACK(30, 1)}};
+    const struct layout_key *got;
+    size_t got_len = 0;
+
+    assert_false(keymap_cache_load("us", &loaded, mods, &mods_len, &got,
+                                   &got_len));
+    assert_true(keymap_layout_init(&layout, strdup(layout_text), 255));
+    keymap_cache_store("us", &layout, mods, 2, keys, 2);
+
+    // A hit hands back everything the layout was stored with
+    mods[1] = 0;
+    assert_true(keymap_cache_load("us", &loaded, mods, &mods_len, &got,
+                                  &got_len));
+    assert_int_equal(mods_len, 2);
+    assert_int_equal(mods[1], 1);
+    assert_int_equal(got_len, 2);
+    assert_int_equal(got[1].cp, 'A');
+    assert_int_equal(got[1].key, KEY_PACK(30, 1));
+    assert_string_equal(loaded.text, layout_text);
+    assert_int_equal(loaded.first, layout.first);
+    assert_int_equal(loaded.keycodes_end, layout.keycodes_end);
+    assert_int_equal(loaded.symbols_end, layout.symbols_end);
+    assert_int_equal(loaded.spare_len, layout.spare_len);
+    keymap_layout_clear(&loaded);
+
+    // Other layouts miss, and so does a file that was cut short
+    assert_false(keymap_cache_load("de", &loaded, mods, &mods_len, &got,
+                                   &got_len));
+    char path[128];
+    snprintf(path, sizeof(path), "%s/waymo/keymap-us-*", dir);
+    glob_t g;
+    assert_int_equal(glob(path, 0, NULL, &g), 0);
+    assert_int_equal(g.gl_pathc, 1);
+    struct stat st;
+    assert_int_equal(stat(g.gl_pathv[0], &st), 0);
+    assert_int_equal(truncate(g.gl_pathv[0], st.st_size - 4), 0);
+    assert_false(keymap_cache_load("us", &loaded, mods, &mods_len, &got,
+                                   &got_len));
+
+    unlink(g.gl_pathv[0]);
+    globfree(&g);
+
+    // Files whose offsets or key levels point out of bounds miss too
+    struct layout_key bad_key = {'x', KEY_PACK(30, 2)};
+    keymap_cache_store("fr", &layout, mods, 2, &bad_key, 1);
+    assert_false(keymap_cache_load("fr", &loaded, mods, &mods_len, &got,
+                                   &got_len));
+    struct keymap_layout bad = layout;
+    bad.max_at = bad.max_end + 1;
+    keymap_cache_store("gb", &bad, mods, 2, keys, 2);
+    assert_false(keymap_cache_load("gb", &loaded, mods, &mods_len, &got,
+                                   &got_len));
+    snprintf(path, sizeof(path), "%s/waymo/keymap-*", dir);
+    assert_int_equal(glob(path, 0, NULL, &g), 0);
+    assert_int_equal(g.gl_pathc, 2);
+    for (size_t i = 0; i < g.gl_pathc; i++)
+        unlink(g.gl_pathv[i]);
+    globfree(&g);
+
+    snprintf(path, sizeof(path), "%s/waymo", dir);
+    rmdir(path);
+    rmdir(dir);
+    keymap_layout_clear(&layout);
+}
+
+static void test_keymap_memfd_sealed(void **state) {
+    struct keymap_entry *keymap = make_keymap(5000);
+    uint32_t size = 0;
+    int fd = keymap_memfd(NULL, keymap, 5000, &size);
+    assert_true(fd >= 0);
+
+    // The compositor gets a NUL terminated string that can no longer change
+    assert_int_equal(lseek(fd, 0, SEEK_END), size);
+    char *text = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    assert_true(text != MAP_FAILED);
+    assert_int_equal(text[size - 1], '\0');
+    assert_int_equal(strlen(text), size - 1);
+    int seals = fcntl(fd, F_GET_SEALS);
+    assert_true(seals & F_SEAL_WRITE);
+    assert_true(seals & F_SEAL_SHRINK);
+    assert_true(seals & F_SEAL_GROW);
+    assert_true(ftruncate(fd, 0) < 0);
+
+    munmap(text, size);
+    close(fd);
+    free(keymap);
+}
+
+static void test_keycode_index(void **state) {
+    keycode_index idx = {0};
+    assert_int_equal(keycode_index_get(&idx, L'a'), KEYCODE_NONE);
+    assert_int_equal(keycode_index_get(&idx, 0x1f600), KEYCODE_NONE);
+
+    // ASCII, the rest of the BMP and above it all take the same keycodes
+    assert_true(keycode_index_put(&idx, L'a', 0));
+    assert_true(keycode_index_put(&idx, 0x4e2d, 1));
+    assert_true(keycode_index_put(&idx, 0x1f600, 2));
+    assert_int_equal(keycode_index_get(&idx, L'a'), 0);
+    assert_int_equal(keycode_index_get(&idx, 0x4e2d), 1);
+    assert_int_equal(keycode_index_get(&idx, 0x1f600), 2);
+    assert_int_equal(keycode_index_get(&idx, L'b'), KEYCODE_NONE);
+
+    // The hash keeps every entry through its growth
+    for (uint32_t i = 0; i < 10000; i++)
+        assert_true(keycode_index_put(&idx, 0x20000 + i, 3 + i));
+    for (uint32_t i = 0; i < 10000; i++)
+        assert_int_equal(keycode_index_get(&idx, 0x20000 + i), 3 + i);
+    assert_int_equal(idx.astral.len, 10001);
+    assert_int_equal(keycode_index_get(&idx, 0x1f600), 2);
+
+    keycode_index_clear(&idx);
+    assert_int_equal(keycode_index_get(&idx, L'a'), KEYCODE_NONE);
+}
+
+static void test_keycode_index_remove(void **state) {
+    keycode_index idx = {0};
+    assert_true(keycode_index_put(&idx, L'a', 0));
+    keycode_index_remove(&idx, L'a');
+    assert_int_equal(keycode_index_get(&idx, L'a'), KEYCODE_NONE);
+
+    // Removing from the middle of probe runs must keep the rest reachable
+    for (uint32_t i = 0; i < 500; i++)
+        assert_true(keycode_index_put(&idx, 0x20000 + i, i));
+    for (uint32_t i = 0; i < 500; i += 3)
+        keycode_index_remove(&idx, 0x20000 + i);
+    for (uint32_t i = 0; i < 500; i++)
+        assert_int_equal(keycode_index_get(&idx, 0x20000 + i),
+                         i % 3 ? i : KEYCODE_NONE);
+
+    // A recycled keycode takes its new character
+    assert_true(keycode_index_put(&idx, 0x1f600, 3));
+    assert_int_equal(keycode_index_get(&idx, 0x1f600), 3);
+    keycode_index_clear(&idx);
+}
+
+static void test_keymap_recycle_skips_staged(void **state) {
+    staged_fixture f;
+    staged_fixture_init(&f);
+    waymo_event_loop *loop = &f.loop;
+    waymoctx *ctx = &f.ctx;
+    loop->keymap_capacity = 2;
+    ctx->keymap_first = 8;
+
+    assert_int_equal(waymoctx_get_keycode(ctx, 0x3b1), 8);
+    assert_int_equal(waymoctx_get_keycode(ctx, 0x3b2), 9);
+    waymoctx_key(ctx, 8, WL_KEYBOARD_KEY_STATE_PRESSED);
+
+    // The coldest key is still staged so the other one is recycled
+    assert_int_equal(waymoctx_get_keycode(ctx, 0x3b3), 9);
+    assert_int_equal(keycode_index_get(&ctx->keycodes, 0x3b1), 8);
+    assert_int_equal(keycode_index_get(&ctx->keycodes, 0x3b2), KEYCODE_NONE);
+
+    // Staged and pinned keys together leave only growing the keymap
+    waymoctx_pin_key(ctx, 9);
+    assert_int_equal(waymoctx_get_keycode(ctx, 0x3b4), 10);
+    assert_int_equal(ctx->keymap_len, 3);
+    assert_int_equal(loop->keymap_evictions, 1);
+    // Counting staged keys as pinned leaves no pins behind
+    assert_int_equal(ctx->keymap[0].pins, 0);
+    assert_int_equal(ctx->keymap[1].pins, 1);
+
+    staged_fixture_clear(&f);
+}
+
+static void test_prepare_text_one_upload(void **state) {
+    wire_fixture f;
+    wire_fixture_init(&f);
+    waymoctx *ctx = f.ctx;
+    uint64_t uploads = f.loop.keymap_uploads;
+
+    // Every new character of the string shares one upload
+    uint32_t cps[] = {0x3b1, 0x3b2, 0x3b3, 0x1f600, 0x3b1};
+    size_t len = sizeof(cps) / sizeof(cps[0]);
+    assert_true(waymoctx_prepare_text(ctx, cps, len));
+    assert_int_equal(f.loop.keymap_uploads - uploads, 1);
+    assert_int_equal(cps[0], cps[4]);
+    wire_fixture_read(&f);
+    assert_int_equal(
+        wire_count(&f, wire_id(ctx->kbd), ZWP_VIRTUAL_KEYBOARD_V1_KEYMAP), 1);
+
+    waymoctx_unpin_keys(ctx, cps, len);
+    wire_fixture_clear(&f);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_keymap_text),
+        cmocka_unit_test(test_keymap_layout_splice),
+        cmocka_unit_test(test_keymap_layout_spare_used_up),
+        cmocka_unit_test(test_keymap_cache),
+        cmocka_unit_test(test_keymap_memfd_sealed),
+        cmocka_unit_test(test_keycode_index),
+        cmocka_unit_test(test_keycode_index_remove),
+        cmocka_unit_test(test_keymap_recycle_skips_staged),
+        cmocka_unit_test(test_prepare_text_one_upload),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,34 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include "waymo/events.h"
+
+// Other tests build loops on the stack zero filled, this one goes through
+// create_event_loop like a caller does
+static void test_create_destroy(void **state) {
+    // Fresh allocations come back filled with garbage so a field that
+    // create_event_loop forgets to set is not quietly zero
+    mallopt(M_PERTURB, 0xa5);
+    for (unsigned int i = 0; i < 4; i++) {
+        eloop_params params = {.max_commands = 8,
+                               .ring_entries = i % 2 ? 8 : 0};
+        waymo_event_loop *loop = create_event_loop(&params);
+        assert_non_null(loop);
+
+        eloop_stats stats;
+        get_event_loop_stats(loop, &stats);
+        assert_int_equal(stats.keymap_evictions, 0);
+        destroy_event_loop(loop);
+    }
+    mallopt(M_PERTURB, 0);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_create_destroy),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
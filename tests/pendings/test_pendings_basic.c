@@ -4,6 +4,7 @@
 #include <cmocka.h>
 #include <stdlib.h>
 #include "events/pendings.h"
+#include "fixtures.h"
 
 // Mocking the loop/context for basic list logic
 static void test_schedule_order(void **state) {
@@ -13,17 +14,21 @@ static void test_schedule_order(void **state) {
     struct pending_action *a1 = calloc(1, sizeof(struct pending_action));
     struct pending_action *a2 = calloc(1, sizeof(struct pending_action));
     
-    a1->expiry_ms = 2000;
-    a2->expiry_ms = 1000;
+    a1->expiry_ns = 2000;
+    a2->expiry_ns = 1000;
 
     // Schedule later one first
     schedule_action(&loop, a1);
     schedule_action(&loop, a2);
 
     // Head should be the one expiring sooner (a2)
-    assert_ptr_equal(loop.pending_head, a2);
-    assert_ptr_equal(loop.pending_head->next, a1);
+    assert_ptr_equal(peek_pending(&loop), a2);
+    assert_ptr_equal(pop_pending_locked(&loop), a2);
+    assert_ptr_equal(pop_pending_locked(&loop), a1);
+    assert_null(pop_pending_locked(&loop));
 
+    free(a1);
+    free(a2);
     clear_pending_actions(&loop);
     pthread_mutex_destroy(&loop.pending_mutex);
 }
@@ -35,15 +40,242 @@ static void test_handle_timer_expiry_empty(void **state) {
     
     // Should not crash on empty list
     handle_timer_expiry(&loop, &ctx);
-    assert_null(loop.pending_head);
+    assert_null(peek_pending(&loop));
     
     pthread_mutex_destroy(&loop.pending_mutex);
 }
 
+static void test_same_expiry_keeps_order(void **state) {
+    waymo_event_loop loop = {0};
+    pthread_mutex_init(&loop.pending_mutex, NULL);
+
+    struct pending_action *acts[8];
+    for (int i = 0; i < 8; i++) {
+        acts[i] = calloc(1, sizeof(struct pending_action));
+        acts[i]->expiry_ns = 500;
+        schedule_action(&loop, acts[i]);
+    }
+
+    // Ties run first come first served like the old sorted list
+    for (int i = 0; i < 8; i++) {
+        assert_ptr_equal(pop_pending_locked(&loop), acts[i]);
+        free(acts[i]);
+    }
+    clear_pending_actions(&loop);
+    pthread_mutex_destroy(&loop.pending_mutex);
+}
+
+static void test_remove_pending(void **state) {
+    waymo_event_loop loop = {0};
+    pthread_mutex_init(&loop.pending_mutex, NULL);
+
+    struct pending_action *acts[16];
+    for (int i = 0; i < 16; i++) {
+        acts[i] = calloc(1, sizeof(struct pending_action));
+        acts[i]->expiry_ns = (i * 7) % 16;
+        schedule_action(&loop, acts[i]);
+    }
+
+    // Remove from the middle, the root and the last slot
+    remove_pending_locked(&loop, acts[5]);
+    remove_pending_locked(&loop, peek_pending(&loop));
+    remove_pending_locked(&loop, loop.pending[loop.pending_len - 1]);
+    assert_int_equal(loop.pending_len, 13);
+
+    uint64_t last = 0;
+    struct pending_action *act;
+    while ((act = pop_pending_locked(&loop))) {
+        assert_true(act->expiry_ns >= last);
+        assert_ptr_not_equal(act, acts[5]);
+        last = act->expiry_ns;
+    }
+    for (int i = 0; i < 16; i++)
+        free(acts[i]);
+    clear_pending_actions(&loop);
+    pthread_mutex_destroy(&loop.pending_mutex);
+}
+
+static void test_periodic_deadlines(void **state) {
+    struct pending_action act = {0};
+
+    // Deadlines sit on the start + tick * interval grid
+    start_periodic(&act, 1000, 0, 250, LATE_CATCH_UP);
+    assert_int_equal(act.expiry_ns, 1000);
+    start_periodic(&act, 1000, 3, 250, LATE_SKIP);
+    assert_int_equal(act.expiry_ns, 1750);
+    assert_int_equal(act.tick, 3);
+    assert_int_equal(act.late, LATE_SKIP);
+}
+
+static void test_type_burst(void **state) {
+    staged_fixture f;
+    staged_fixture_init(&f);
+    waymo_event_loop *loop = &f.loop;
+    waymoctx *ctx = &f.ctx;
+    loop->type_burst = 3;
+
+    struct pending_action *act = fixture_action(ACTION_TYPE_STEP, 0, 0);
+    act->data.type_txt.codes = calloc(7, sizeof(uint32_t));
+    act->data.type_txt.len = 7;
+    start_periodic(act, 0, 0, 0, LATE_CATCH_UP);
+    schedule_action(loop, act);
+
+    // A zero interval sends a burst per expiry rather than every key at once
+    size_t expected[] = {6, 12, 14};
+    for (int i = 0; i < 3; i++) {
+        handle_timer_expiry(loop, ctx);
+        assert_int_equal(ctx->staged_len, expected[i]);
+        if (peek_pending(loop))
+            peek_pending(loop)->expiry_ns = 0;
+    }
+    assert_null(peek_pending(loop));
+    assert_int_equal(loop->finished_len, 1);
+
+    staged_fixture_clear(&f);
+}
+
+static void test_u64_map_grow(void **state) {
+    u64_map map = {0};
+    for (uint32_t code = 0; code < 100; code++)
+        u64_map_put(&map, code)->u32 = code * 2;
+    assert_int_equal(map.len, 100);
+
+    // Taking entries out of the middle of runs must not hide later ones
+    struct u64_entry out;
+    for (uint32_t code = 0; code < 100; code += 2) {
+        assert_true(u64_map_take(&map, code, &out));
+        assert_int_equal(out.u32, code * 2);
+    }
+    assert_false(u64_map_take(&map, 0, &out));
+    for (uint32_t code = 1; code < 100; code += 2)
+        assert_int_equal(u64_map_get(&map, code)->u32, code * 2);
+    assert_null(u64_map_get(&map, 2));
+    assert_null(u64_map_put(&map, U64_MAP_EMPTY));
+    assert_int_equal(map.len, 50);
+
+    u64_map_clear(&map);
+}
+
+static void test_release_held_key(void **state) {
+    staged_fixture f;
+    staged_fixture_init(&f);
+    waymo_event_loop *loop = &f.loop;
+    waymoctx *ctx = &f.ctx;
+
+    struct pending_action *other = fixture_action(ACTION_KEY_RELEASE, 100, 0);
+    schedule_action(loop, other);
+
+    struct pending_action *repeat = fixture_action(ACTION_KEY_HOLD, 0, 0);
+    struct u64_entry *held = u64_map_put(&loop->held, 30);
+    held->u32 = KEY_PACK(30, 1);
+    held->ptr = repeat;
+    start_periodic(repeat, 0, 1, 50, LATE_SKIP);
+    schedule_action(loop, repeat);
+
+    // An up for another level of the same key still lets go of the held one
+    // and takes its repeat with it
+    release_held_key(loop, ctx, KEY_PACK(30, 0));
+    assert_int_equal(loop->held.len, 0);
+    assert_int_equal(loop->pending_len, 1);
+    assert_ptr_equal(peek_pending(loop), other);
+    assert_int_equal(ctx->staged_len, 1);
+    assert_int_equal(ctx->staged[0].keycode, KEY_PACK(30, 1));
+    assert_int_equal(ctx->staged[0].state, WL_KEYBOARD_KEY_STATE_RELEASED);
+
+    // A key that was never held is released all the same
+    release_held_key(loop, ctx, KEY_PACK(31, 0));
+    assert_int_equal(ctx->staged_len, 2);
+
+    staged_fixture_clear(&f);
+}
+
+static void test_key_up_never_claims(void **state) {
+    staged_fixture f;
+    staged_fixture_init(&f);
+    waymo_event_loop *loop = &f.loop;
+    waymoctx *ctx = &f.ctx;
+    // Never written to, every key stays staged
+    ctx->kbd = (struct zwp_virtual_keyboard_v1 *)ctx;
+    command_param up = {.keyboard_key = {.key = 'x', .active_opt = DOWN}};
+
+    // A character with no key was never pressed, so nothing is sent
+    ekbd_key(loop, ctx, &up, (completion){.fd = -1});
+    assert_int_equal(ctx->keymap_len, 0);
+    assert_int_equal(keycode_index_get(&ctx->keycodes, 'x'), KEYCODE_NONE);
+    assert_int_equal(ctx->staged_len, 0);
+    assert_int_equal(loop->finished_len, 1);
+    assert_int_equal(loop->finished[0].result, RESULT_DONE);
+
+    // One with a key is released even if it was not held
+    assert_true(keycode_index_put(&ctx->keycodes, 'y', KEY_PACK(21, 0)));
+    up.keyboard_key.key = 'y';
+    ekbd_key(loop, ctx, &up, (completion){.fd = -1});
+    assert_int_equal(ctx->staged_len, 1);
+    assert_int_equal(ctx->staged[0].keycode, KEY_PACK(21, 0));
+    assert_int_equal(ctx->staged[0].state, WL_KEYBOARD_KEY_STATE_RELEASED);
+
+    staged_fixture_clear(&f);
+}
+
+static void test_cancel_actions(void **state) {
+    staged_fixture f;
+    staged_fixture_init(&f);
+    waymo_event_loop *loop = &f.loop;
+    waymoctx *ctx = &f.ctx;
+
+    // Enough tickets to grow the index a few times
+    struct pending_action *acts[200];
+    for (int i = 0; i < 200; i++) {
+        acts[i] = fixture_action(ACTION_KEY_REPEAT, 1000 + i, i + 1);
+        schedule_action(loop, acts[i]);
+    }
+    struct pending_action *type = fixture_action(ACTION_TYPE_STEP, 500, 1000);
+    type->data.type_txt.codes = calloc(4, sizeof(uint32_t));
+    type->data.type_txt.len = 4;
+    schedule_action(loop, type);
+
+    assert_true(cancel_actions(loop, ctx, 1000));
+    assert_true(cancel_actions(loop, ctx, 7));
+    // Gone already, or never there
+    assert_false(cancel_actions(loop, ctx, 7));
+    assert_false(cancel_actions(loop, ctx, 5000));
+    assert_int_equal(loop->pending_len, 199);
+    assert_int_equal(loop->tickets.len, 199);
+    assert_int_equal(loop->finished_len, 2);
+    assert_int_equal(loop->finished[0].done.ticket, 1000);
+    assert_int_equal(loop->finished[0].result, RESULT_CANCELLED);
+    // The heap still hands out the rest in order
+    assert_ptr_equal(peek_pending(loop), acts[0]);
+
+    loop->held_buttons = 1u << (BTN_RIGHT - BTN_MOUSE);
+    waymoctx_key(ctx, KEY_PACK(30, 0), WL_KEYBOARD_KEY_STATE_PRESSED);
+    waymoctx_key(ctx, KEY_PACK(30, 0), WL_KEYBOARD_KEY_STATE_RELEASED);
+    waymoctx_key(ctx, KEY_PACK(31, 0), WL_KEYBOARD_KEY_STATE_PRESSED);
+    assert_true(cancel_actions(loop, ctx, 0));
+    assert_null(peek_pending(loop));
+    assert_int_equal(loop->held_buttons, 0);
+    // Staged presses never go out, releases still do
+    assert_int_equal(ctx->staged_len, 1);
+    assert_int_equal(ctx->staged[0].state, WL_KEYBOARD_KEY_STATE_RELEASED);
+    assert_int_equal(loop->tickets.len, 0);
+    assert_int_equal(loop->finished_len, 201);
+    assert_int_equal(loop->finished[200].result, RESULT_CANCELLED);
+
+    staged_fixture_clear(&f);
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_schedule_order),
-	cmocka_unit_test(test_handle_timer_expiry_empty)
+	cmocka_unit_test(test_handle_timer_expiry_empty),
+	cmocka_unit_test(test_same_expiry_keeps_order),
+	cmocka_unit_test(test_remove_pending),
+	cmocka_unit_test(test_periodic_deadlines),
+	cmocka_unit_test(test_type_burst),
+	cmocka_unit_test(test_u64_map_grow),
+	cmocka_unit_test(test_release_held_key),
+	cmocka_unit_test(test_key_up_never_claims),
+	cmocka_unit_test(test_cancel_actions),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -20,7 +20,7 @@ static void *schedule_thread(void *arg) {
     thread_data *data = (thread_data *)arg;
     for (int i = 0; i < ACTIONS_PER_THREAD; i++) {
         struct pending_action *a = calloc(1, sizeof(struct pending_action));
-        a->expiry_ms = timestamp() + (rand() % 1000);
+        a->expiry_ns = timestamp() + (rand() % 1000);
         schedule_action(data->loop, a);
         usleep(100); // Add some jitter
     }
@@ -45,16 +45,16 @@ static void test_concurrent_scheduling(void **state) {
         pthread_join(threads[i], NULL);
     }
     
-    // Verify list integrity
+    // Verify heap integrity
     pthread_mutex_lock(&loop.pending_mutex);
-    struct pending_action *curr = loop.pending_head;
+    struct pending_action *curr;
     int count = 0;
     uint64_t last_expiry = 0;
     
-    while (curr) {
-        assert_true(curr->expiry_ms >= last_expiry); // Should be sorted
-        last_expiry = curr->expiry_ms;
-        curr = curr->next;
+    while ((curr = pop_pending_locked(&loop))) {
+        assert_true(curr->expiry_ns >= last_expiry); // Should be sorted
+        last_expiry = curr->expiry_ns;
+        free(curr);
         count++;
     }
     
@@ -8,11 +8,10 @@
 static void test_clear_empty_list(void **state) {
     waymo_event_loop loop = {0};
     pthread_mutex_init(&loop.pending_mutex, NULL);
-    loop.pending_head = NULL;
 
     // Should not crash
     clear_pending_actions(&loop);
-    assert_null(loop.pending_head);
+    assert_null(peek_pending(&loop));
     pthread_mutex_destroy(&loop.pending_mutex);
 }
 
@@ -20,23 +19,51 @@ static void test_rapid_scheduling(void **state) {
     waymo_event_loop loop = {0};
     pthread_mutex_init(&loop.pending_mutex, NULL);
 
-    // Insert 1000 actions with descending expiry to force list traversal
+    // Insert 1000 actions with descending expiry, each becomes the new root
     for (int i = 1000; i > 0; i--) {
         struct pending_action *a = calloc(1, sizeof(struct pending_action));
-        a->expiry_ms = i;
+        a->expiry_ns = i;
         schedule_action(&loop, a);
     }
 
-    assert_int_equal(loop.pending_head->expiry_ms, 1);
+    assert_int_equal(peek_pending(&loop)->expiry_ns, 1);
     
     clear_pending_actions(&loop);
     pthread_mutex_destroy(&loop.pending_mutex);
 }
 
+static void test_100k_scheduled_actions(void **state) {
+    waymo_event_loop loop = {0};
+    pthread_mutex_init(&loop.pending_mutex, NULL);
+    srand(42);
+
+    for (int i = 0; i < 100000; i++) {
+        struct pending_action *a = calloc(1, sizeof(struct pending_action));
+        a->expiry_ns = rand() % 50000;
+        assert_true(schedule_action(&loop, a));
+    }
+    assert_int_equal(loop.pending_len, 100000);
+
+    // Pop half in order then leave the rest for clear_pending_actions
+    uint64_t last = 0;
+    for (int i = 0; i < 50000; i++) {
+        struct pending_action *a = pop_pending_locked(&loop);
+        assert_true(a->expiry_ns >= last);
+        last = a->expiry_ns;
+        free(a);
+    }
+    assert_true(peek_pending(&loop)->expiry_ns >= last);
+
+    clear_pending_actions(&loop);
+    assert_int_equal(loop.pending_len, 0);
+    pthread_mutex_destroy(&loop.pending_mutex);
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_clear_empty_list),
         cmocka_unit_test(test_rapid_scheduling),
+        cmocka_unit_test(test_100k_scheduled_actions),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
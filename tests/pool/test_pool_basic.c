@@ -0,0 +1,138 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "events/pendings.h"
+#include "events/pool.h"
+
+#define NUM_THREADS 4
+#define ROUNDS 20000
+
+static void test_pool_exhaustion(void **state) {
+    object_pool *p = create_pool(3, sizeof(uint64_t));
+    assert_non_null(p);
+
+    void *objs[3];
+    for (int i = 0; i < 3; i++) {
+        objs[i] = pool_get(p);
+        assert_non_null(objs[i]);
+        assert_true(pool_owns(p, objs[i]));
+    }
+    assert_null(pool_get(p));
+    assert_int_equal(atomic_load(&p->misses), 1);
+    assert_int_equal(pool_high_water(p), 3);
+
+    // Returned objects are handed out again before anything new
+    pool_put(p, objs[1]);
+    assert_ptr_equal(pool_get(p), objs[1]);
+
+    uint64_t outside;
+    assert_false(pool_owns(p, &outside));
+    assert_false(pool_owns(NULL, &outside));
+    assert_null(create_pool(0, sizeof(uint64_t)));
+    destroy_pool(p);
+}
+
+static void test_pool_high_water(void **state) {
+    object_pool *p = create_pool(16, sizeof(uint64_t));
+
+    // Taking and returning one at a time never needs a second object
+    for (int i = 0; i < 100; i++)
+        pool_put(p, pool_get(p));
+    assert_int_equal(pool_high_water(p), 1);
+
+    void *a = pool_get(p), *b = pool_get(p);
+    pool_put(p, a);
+    pool_put(p, b);
+    assert_int_equal(pool_high_water(p), 2);
+    destroy_pool(p);
+}
+
+static void *churn(void *arg) {
+    object_pool *p = arg;
+    bool clash = false;
+    for (int i = 0; i < ROUNDS; i++) {
+        uint64_t *obj = pool_get(p);
+        if (!obj) {
+            sched_yield();
+            continue;
+        }
+        // Nobody else may hold this object while we do
+        *obj = (uint64_t)pthread_self();
+        sched_yield();
+        if (*obj != (uint64_t)pthread_self())
+            clash = true;
+        pool_put(p, obj);
+    }
+    return clash ? arg : NULL;
+}
+
+static void test_pool_concurrent(void **state) {
+    object_pool *p = create_pool(NUM_THREADS - 1, sizeof(uint64_t));
+    pthread_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_create(&threads[i], NULL, churn, p);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        void *clash;
+        pthread_join(threads[i], &clash);
+        assert_null(clash);
+    }
+
+    // Every object made it back onto the free list exactly once
+    void *seen[NUM_THREADS - 1];
+    for (int i = 0; i < NUM_THREADS - 1; i++) {
+        seen[i] = pool_get(p);
+        assert_non_null(seen[i]);
+        for (int j = 0; j < i; j++)
+            assert_ptr_not_equal(seen[i], seen[j]);
+    }
+    assert_null(pool_get(p));
+    destroy_pool(p);
+}
+
+static void test_pending_pool_fallback(void **state) {
+    waymo_event_loop loop = {0};
+    loop.pending_pool = create_pool(1, sizeof(struct pending_action));
+
+    struct pending_action *a = alloc_pending(&loop);
+    struct pending_action *b = alloc_pending(&loop);
+    assert_true(pool_owns(loop.pending_pool, a));
+    assert_false(pool_owns(loop.pending_pool, b));
+
+    // Both kinds go back the way they came
+    free_pending(&loop, b);
+    free_pending(&loop, a);
+    assert_ptr_equal(alloc_pending(&loop), a);
+    destroy_pool(loop.pending_pool);
+}
+
+static void test_command_pool_reuse(void **state) {
+    waymo_event_loop loop = {0};
+    loop.cmd_pool = create_pool(1, sizeof(command));
+
+    command *a = _create_keyboard_type_cmd(&loop, "hi", NULL);
+    assert_ptr_equal(a->pool, loop.cmd_pool);
+    command *b = _create_mouse_move_cmd(&loop, 1, 1, false);
+    assert_null(b->pool);
+
+    free_command(a);
+    free_command(b);
+    command *c = _create_mouse_move_cmd(&loop, 2, 2, false);
+    assert_ptr_equal(c, a);
+    free_command(c);
+    destroy_pool(loop.cmd_pool);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_pool_exhaustion),
+        cmocka_unit_test(test_pool_high_water),
+        cmocka_unit_test(test_pool_concurrent),
+        cmocka_unit_test(test_pending_pool_fallback),
+        cmocka_unit_test(test_command_pool_reuse),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -11,21 +11,21 @@ static void test_queue_create_destroy(void **state) {
     command_queue *q = create_queue(10);
     assert_non_null(q);
     assert_int_equal(q->max_capacity, 10);
-    assert_int_equal(q->num_commands, 0);
+    assert_int_equal(count_queue(q), 0);
     assert_true(q->fd >= 0);
     destroy_queue(q);
 }
 
 static void test_queue_add_remove(void **state) {
     command_queue *q = create_queue(5);
-    command *cmd = malloc(sizeof(command));
+    command *cmd = calloc(1, sizeof(command));
     
     assert_true(add_queue(q, cmd));
-    assert_int_equal(q->num_commands, 1);
+    assert_int_equal(count_queue(q), 1);
     
     command *removed = remove_queue(q);
     assert_ptr_equal(cmd, removed);
-    assert_int_equal(q->num_commands, 0);
+    assert_int_equal(count_queue(q), 0);
     
     free(removed);
     destroy_queue(q);
@@ -33,7 +33,7 @@ static void test_queue_add_remove(void **state) {
 
 static void test_queue_eventfd_signaling(void **state) {
     command_queue *q = create_queue(5);
-    command *cmd = malloc(sizeof(command));
+    command *cmd = calloc(1, sizeof(command));
     
     // 1. Verify FD is initially quiet
     struct pollfd pfd = {
@@ -63,11 +63,93 @@ static void test_queue_eventfd_signaling(void **state) {
     destroy_queue(q);
 }
 
+static void test_queue_wakeup_coalescing(void **state) {
+    command_queue *q = create_queue(20);
+    command *cmds[20];
+
+    // A burst before the consumer acks costs a single eventfd write
+    for (int i = 0; i < 10; i++) {
+        cmds[i] = calloc(1, sizeof(command));
+        assert_true(add_queue(q, cmds[i]));
+    }
+    assert_int_equal(atomic_load(&q->wakeups), 1);
+
+    uint64_t count = 0;
+    assert_int_equal(read(q->fd, &count, sizeof(count)), sizeof(uint64_t));
+    assert_int_equal(count, 1);
+
+    // Once the consumer re-arms, the next burst signals exactly once more
+    assert_true(ack_queue(q));
+    for (int i = 10; i < 20; i++) {
+        cmds[i] = calloc(1, sizeof(command));
+        assert_true(add_queue(q, cmds[i]));
+    }
+    assert_int_equal(atomic_load(&q->wakeups), 2);
+
+    for (int i = 0; i < 20; i++)
+        free(remove_queue(q));
+    destroy_queue(q);
+}
+
+static void test_queue_mute(void **state) {
+    command_queue *q = create_queue(20);
+    command *cmds[20];
+
+    cmds[0] = calloc(1, sizeof(command));
+    assert_true(add_queue(q, cmds[0]));
+    assert_int_equal(atomic_load(&q->wakeups), 1);
+
+    // Muting clears the wakeup but producers still see the queue as signalled
+    assert_true(mute_queue(q));
+    for (int i = 1; i < 20; i++) {
+        cmds[i] = calloc(1, sizeof(command));
+        assert_true(add_queue(q, cmds[i]));
+    }
+    assert_int_equal(atomic_load(&q->wakeups), 1);
+
+    for (int i = 0; i < 20; i++)
+        free(remove_queue(q));
+    destroy_queue(q);
+}
+
+static void test_queue_peek_hold(void **state) {
+    command_queue *q = create_queue(4);
+    assert_null(peek_queue(q));
+
+    command *a = calloc(1, sizeof(command));
+    command *b = calloc(1, sizeof(command));
+    assert_true(add_queue(q, a));
+    assert_true(add_queue(q, b));
+    // Peeking leaves the head where it is
+    assert_ptr_equal(peek_queue(q), a);
+    assert_ptr_equal(peek_queue(q), a);
+    assert_ptr_equal(remove_queue(q), a);
+    assert_ptr_equal(peek_queue(q), b);
+
+    // A held queue takes commands without waking anyone until acked
+    uint64_t count;
+    assert_int_equal(read(q->fd, &count, sizeof(count)), sizeof(uint64_t));
+    assert_true(ack_queue(q));
+    hold_queue(q);
+    assert_true(add_queue(q, a));
+    assert_int_equal(atomic_load(&q->wakeups), 1);
+    assert_true(ack_queue(q));
+    assert_true(add_queue(q, calloc(1, sizeof(command))));
+    assert_int_equal(atomic_load(&q->wakeups), 2);
+
+    for (int i = 0; i < 3; i++)
+        free(remove_queue(q));
+    destroy_queue(q);
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_queue_create_destroy),
         cmocka_unit_test(test_queue_add_remove),
 	cmocka_unit_test(test_queue_eventfd_signaling),
+	cmocka_unit_test(test_queue_wakeup_coalescing),
+	cmocka_unit_test(test_queue_mute),
+	cmocka_unit_test(test_queue_peek_hold),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
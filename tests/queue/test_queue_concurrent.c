@@ -30,7 +30,7 @@ static bool spin_add(command_queue *q, command *c) {
 static void* producer_func(void *arg) {
     command_queue *q = (command_queue *)arg;
     for (int i = 0; i < CMDS_PER_PRODUCER; i++) {
-        command *c = malloc(sizeof(command));
+        command *c = calloc(1, sizeof(command));
         if (!spin_add(q, c)) {
             free(c);
             break;
@@ -169,7 +169,7 @@ static void test_fifo_integrity(void **state) {
 static void* spam_producer(void *arg) {
     command_queue *q = (command_queue *)arg;
     while (!atomic_load(&q->shutdown)) {
-        command *c = malloc(sizeof(command));
+        command *c = calloc(1, sizeof(command));
         // We don't care if it succeeds or fails, just checking for crashes
         if (!add_queue(q, c)) {
             free(c);
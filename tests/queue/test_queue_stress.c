@@ -8,9 +8,9 @@
 
 static void test_queue_overflow(void **state) {
     command_queue *q = create_queue(2);
-    command *c1 = malloc(sizeof(command));
-    command *c2 = malloc(sizeof(command));
-    command *c3 = malloc(sizeof(command));
+    command *c1 = calloc(1, sizeof(command));
+    command *c2 = calloc(1, sizeof(command));
+    command *c3 = calloc(1, sizeof(command));
 
     assert_true(add_queue(q, c1));
     assert_true(add_queue(q, c2));
@@ -26,7 +26,7 @@ static void test_queue_overflow(void **state) {
 
 static void test_queue_shutdown_behavior(void **state) {
     command_queue *q = create_queue(5);
-    command *c1 = malloc(sizeof(command));
+    command *c1 = calloc(1, sizeof(command));
     
     // Manual shutdown simulation
     atomic_store(&q->shutdown, true);
@@ -36,10 +36,34 @@ static void test_queue_shutdown_behavior(void **state) {
     destroy_queue(q);
 }
 
+static void test_queue_wraparound(void **state) {
+    // Odd capacity so slot indices and ring laps never line up
+    command_queue *q = create_queue(3);
+    command *cmds[3];
+    for (int i = 0; i < 3; i++)
+        cmds[i] = calloc(1, sizeof(command));
+
+    for (int lap = 0; lap < 10; lap++) {
+        for (int i = 0; i < 3; i++)
+            assert_true(add_queue(q, cmds[i]));
+        assert_false(add_queue(q, cmds[0]));
+        assert_int_equal(count_queue(q), 3);
+
+        for (int i = 0; i < 3; i++)
+            assert_ptr_equal(remove_queue(q), cmds[i]);
+        assert_null(remove_queue(q));
+    }
+
+    for (int i = 0; i < 3; i++)
+        free(cmds[i]);
+    destroy_queue(q);
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_queue_overflow),
         cmocka_unit_test(test_queue_shutdown_behavior),
+        cmocka_unit_test(test_queue_wraparound),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -0,0 +1,199 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include "events/event_loop.h"
+#include "events/ring.h"
+#include "waymo/rings.h"
+
+#define NUM_PRODUCERS 4
+#define RECORDS_PER_PRODUCER 2000
+
+static void test_ring_order_and_wraparound(void **state) {
+    record_ring *r = create_ring(3, sizeof(waymo_cqe), false);
+    assert_non_null(r);
+    assert_int_equal(r->stride % 64, 0);
+
+    // Go around the ring several times to cover slot reuse
+    for (uint64_t i = 0; i < 10; i++) {
+        waymo_cqe in = {.user_data = i, .result = RESULT_DONE};
+        assert_true(push_ring(r, &in));
+        if (i % 3 == 2) {
+            for (uint64_t j = i - 2; j <= i; j++) {
+                waymo_cqe out;
+                assert_true(pop_ring(r, &out));
+                assert_int_equal(out.user_data, j);
+            }
+        }
+    }
+
+    waymo_cqe out;
+    assert_true(pop_ring(r, &out));
+    assert_int_equal(out.user_data, 9);
+    assert_false(pop_ring(r, &out));
+    destroy_ring(r);
+}
+
+static void test_ring_full(void **state) {
+    record_ring *r = create_ring(2, sizeof(uint64_t), false);
+    uint64_t v = 1;
+    assert_true(push_ring(r, &v));
+    assert_true(push_ring(r, &v));
+    assert_false(push_ring(r, &v));
+    assert_int_equal(count_ring(r), 2);
+    destroy_ring(r);
+
+    assert_null(create_ring(0, sizeof(uint64_t), false));
+}
+
+static void test_ring_wakes_only_when_parked(void **state) {
+    record_ring *r = create_ring(8, sizeof(uint64_t), true);
+    struct pollfd pfd = {.fd = r->fd, .events = POLLIN};
+    uint64_t v = 1, out;
+
+    // A busy consumer is not woken
+    assert_true(push_ring(r, &v));
+    kick_ring(r);
+    assert_int_equal(poll(&pfd, 1, 0), 0);
+
+    // Parking with work pending is refused
+    assert_false(park_ring(r));
+    assert_true(pop_ring(r, &out));
+
+    // A parked consumer is woken once however many kicks arrive
+    assert_true(park_ring(r));
+    for (int i = 0; i < 5; i++) {
+        assert_true(push_ring(r, &v));
+        kick_ring(r);
+    }
+    assert_int_equal(poll(&pfd, 1, 0), 1);
+    assert_int_equal(atomic_load(&r->wakeups), 1);
+    assert_true(ack_ring(r));
+    assert_int_equal(poll(&pfd, 1, 0), 0);
+    unpark_ring(r);
+
+    destroy_ring(r);
+}
+
+static void *ring_producer(void *arg) {
+    record_ring *r = arg;
+    for (uint64_t i = 0; i < RECORDS_PER_PRODUCER; i++) {
+        while (!push_ring(r, &i))
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void test_ring_concurrent(void **state) {
+    record_ring *r = create_ring(16, sizeof(uint64_t), false);
+    pthread_t threads[NUM_PRODUCERS];
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_create(&threads[i], NULL, ring_producer, r);
+
+    // Every record arrives exactly once
+    uint64_t sum = 0, out;
+    int got = 0;
+    while (got < NUM_PRODUCERS * RECORDS_PER_PRODUCER) {
+        if (pop_ring(r, &out)) {
+            sum += out;
+            got++;
+        } else {
+            sched_yield();
+        }
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_join(threads[i], NULL);
+
+    uint64_t expected = (uint64_t)NUM_PRODUCERS * RECORDS_PER_PRODUCER *
+                        (RECORDS_PER_PRODUCER - 1) / 2;
+    assert_int_equal(sum, expected);
+    assert_false(pop_ring(r, &out));
+    destroy_ring(r);
+}
+
+static void test_ring_submit_bounded_by_completions(void **state) {
+    waymo_event_loop loop = {0};
+    loop.sq = create_ring(4, sizeof(waymo_sqe), true);
+    loop.cq = create_ring(6, sizeof(waymo_cqe), false);
+    atomic_init(&loop.ring_inflight, 0);
+
+    waymo_sqe sqes[8];
+    for (int i = 0; i < 8; i++)
+        sqes[i] = (waymo_sqe){.op = SQE_MOUSE_MOVE, .user_data = i};
+
+    // The submission ring is the limit first
+    assert_int_equal(waymo_ring_submit(&loop, sqes, 8), 4);
+    waymo_sqe taken;
+    for (int i = 0; i < 4; i++)
+        assert_true(pop_ring(loop.sq, &taken));
+
+    // Then the room left for completions
+    assert_int_equal(waymo_ring_submit(&loop, sqes, 8), 2);
+    assert_int_equal(waymo_ring_submit(&loop, sqes, 8), 0);
+
+    waymo_cqe cqe = {.user_data = 42, .result = RESULT_FAILED};
+    assert_true(push_ring(loop.cq, &cqe));
+    waymo_cqe reaped[4];
+    assert_int_equal(waymo_ring_reap(&loop, reaped, 4), 1);
+    assert_int_equal(reaped[0].user_data, 42);
+    assert_int_equal(reaped[0].result, RESULT_FAILED);
+    assert_int_equal(atomic_load(&loop.ring_inflight), 5);
+
+    // Loops without rings refuse everything
+    waymo_event_loop plain = {0};
+    assert_int_equal(waymo_ring_submit(&plain, sqes, 1), 0);
+    assert_int_equal(waymo_ring_reap(&plain, reaped, 4), 0);
+
+    destroy_ring(loop.sq);
+    destroy_ring(loop.cq);
+}
+
+static void test_command_from_sqe(void **state) {
+    command cmd;
+    waymo_sqe sqe = {.op = SQE_KEYBOARD_HOLD,
+                     .hold = {.key = 'a', .hold_ms = 50}};
+    assert_true(command_from_sqe(&sqe, &cmd));
+    assert_int_equal(cmd.type, CMD_KEYBOARD_KEY);
+    assert_int_equal(cmd.param.keyboard_key.active_opt, HOLD);
+    assert_int_equal(cmd.param.keyboard_key.keyboard_key_mod.hold_ns,
+                     50000000);
+    assert_int_equal(cmd.param.keyboard_key.interval_ns,
+                     DEFAULT_HOLD_INTERVAL_MS * 1000000);
+
+    sqe = (waymo_sqe){.op = SQE_KEYBOARD_TYPE, .type = {.text = NULL}};
+    assert_false(command_from_sqe(&sqe, &cmd));
+
+    // Decoded text belongs to the command until something takes it
+    sqe.type.text = "h\xc3\xa9";
+    assert_true(command_from_sqe(&sqe, &cmd));
+    assert_int_equal(cmd.param.kbd.len, 2);
+    assert_int_equal(cmd.param.kbd.cps[1], 0xe9);
+    clear_command(&cmd);
+    assert_null(cmd.param.kbd.cps);
+
+    // A zero interval is the default here, bursts need asking for
+    assert_true(command_from_sqe(&sqe, &cmd));
+    assert_int_equal(cmd.param.kbd.interval_ns,
+                     DEFAULT_TYPE_INTERVAL_MS * 1000000);
+    clear_command(&cmd);
+    sqe.type.burst = true;
+    assert_true(command_from_sqe(&sqe, &cmd));
+    assert_int_equal(cmd.param.kbd.interval_ns, 0);
+    clear_command(&cmd);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_ring_order_and_wraparound),
+        cmocka_unit_test(test_ring_full),
+        cmocka_unit_test(test_ring_wakes_only_when_parked),
+        cmocka_unit_test(test_ring_concurrent),
+        cmocka_unit_test(test_ring_submit_bounded_by_completions),
+        cmocka_unit_test(test_command_from_sqe),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
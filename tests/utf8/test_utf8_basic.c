@@ -0,0 +1,62 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include "events/utf8.h"
+
+static size_t decode(const char *s, uint32_t *out) {
+    return utf8_decode(s, strlen(s), out);
+}
+
+static void test_utf8_ascii_runs(void **state) {
+    // Long enough to go through the word at a time path and its tail
+    const char *s = "The quick brown fox jumps!";
+    uint32_t out[32];
+    assert_int_equal(decode(s, out), strlen(s));
+    for (size_t i = 0; i < strlen(s); i++)
+        assert_int_equal(out[i], (unsigned char)s[i]);
+}
+
+static void test_utf8_multibyte(void **state) {
+    // 2, 3 and 4 byte sequences between ASCII, including one inside a word
+    uint32_t out[16];
+    assert_int_equal(decode("a\xc3\xa9z\xe4\xb8\xad\xf0\x9f\x98\x80", out), 5);
+    assert_int_equal(out[0], 'a');
+    assert_int_equal(out[1], 0xe9);
+    assert_int_equal(out[2], 'z');
+    assert_int_equal(out[3], 0x4e2d);
+    assert_int_equal(out[4], 0x1f600);
+
+    assert_int_equal(decode("abcdefg\xc3\xa9hij", out), 11);
+    assert_int_equal(out[7], 0xe9);
+    assert_int_equal(out[8], 'h');
+}
+
+static void test_utf8_invalid(void **state) {
+    uint32_t out[16];
+    // Overlong, surrogate, lone continuation and truncated sequences all fall
+    // back to their bytes one at a time
+    assert_int_equal(decode("\xc0\xaf", out), 2);
+    assert_int_equal(out[0], 0xc0);
+    assert_int_equal(out[1], 0xaf);
+    assert_int_equal(decode("\xed\xa0\x80", out), 3);
+    assert_int_equal(out[0], 0xed);
+    assert_int_equal(decode("\x80x", out), 2);
+    assert_int_equal(out[1], 'x');
+    assert_int_equal(decode("\xe4\xb8", out), 2);
+    assert_int_equal(out[0], 0xe4);
+    assert_int_equal(out[1], 0xb8);
+    assert_int_equal(decode("\xf4\x90\x80\x80", out), 4);
+
+    assert_int_equal(utf8_decode("", 0, out), 0);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_utf8_ascii_runs),
+        cmocka_unit_test(test_utf8_multibyte),
+        cmocka_unit_test(test_utf8_invalid),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}